@@ -0,0 +1,163 @@
+/* Smile MMALSRC GStreamer element
+ * Copyright (C) 2017 Alexandra Hospital <hospital.alex@gmail.com>
+ * Copyright (C) 2017 Fabien Dutuit <fabien.dutuit@smile.fr>
+ *
+ * Metadata attached by mmalsrc to the pushed buffers.
+ */
+
+#include "gstmmalmeta.h"
+
+/******************************************************************
+ ******************************************************************
+ * Latency meta
+ ******************************************************************
+ ******************************************************************/
+
+GType gst_mmalsrc_latency_meta_api_get_type(void) {
+	static volatile GType type = 0;
+	static const gchar *tags[] = { NULL };
+
+	if (g_once_init_enter(&type)) {
+		GType _type = gst_meta_api_type_register("GstMMALSrcLatencyMetaAPI",
+				tags);
+		g_once_init_leave(&type, _type);
+	}
+	return type;
+}
+
+static gboolean gst_mmalsrc_latency_meta_init(GstMeta *meta, gpointer params,
+		GstBuffer *buffer) {
+	GstMMALSrcLatencyMeta *lmeta = (GstMMALSrcLatencyMeta *) meta;
+
+	lmeta->sensor = 0;
+	lmeta->callback = 0;
+	lmeta->dequeue = 0;
+	lmeta->push = 0;
+	return TRUE;
+}
+
+static gboolean gst_mmalsrc_latency_meta_transform(GstBuffer *dest,
+		GstMeta *meta, GstBuffer *buffer, GQuark type, gpointer data) {
+	GstMMALSrcLatencyMeta *smeta = (GstMMALSrcLatencyMeta *) meta;
+	GstMMALSrcLatencyMeta *dmeta;
+
+	/* Timestamps still hold for copies of the frame */
+	if (!GST_META_TRANSFORM_IS_COPY(type))
+		return FALSE;
+
+	dmeta = gst_buffer_add_mmalsrc_latency_meta(dest);
+	if (!dmeta)
+		return FALSE;
+
+	dmeta->sensor = smeta->sensor;
+	dmeta->callback = smeta->callback;
+	dmeta->dequeue = smeta->dequeue;
+	dmeta->push = smeta->push;
+	return TRUE;
+}
+
+const GstMetaInfo *gst_mmalsrc_latency_meta_get_info(void) {
+	static const GstMetaInfo *meta_info = NULL;
+
+	if (g_once_init_enter(&meta_info)) {
+		const GstMetaInfo *mi = gst_meta_register(
+				GST_MMALSRC_LATENCY_META_API_TYPE, "GstMMALSrcLatencyMeta",
+				sizeof(GstMMALSrcLatencyMeta), gst_mmalsrc_latency_meta_init,
+				NULL, gst_mmalsrc_latency_meta_transform);
+		g_once_init_leave(&meta_info, mi);
+	}
+	return meta_info;
+}
+
+GstMMALSrcLatencyMeta *gst_buffer_add_mmalsrc_latency_meta(GstBuffer *buffer) {
+	return (GstMMALSrcLatencyMeta *) gst_buffer_add_meta(buffer,
+			GST_MMALSRC_LATENCY_META_INFO, NULL);
+}
+
+/******************************************************************
+ ******************************************************************
+ * Pyramid meta
+ ******************************************************************
+ ******************************************************************/
+
+GType gst_mmalsrc_pyramid_meta_api_get_type(void) {
+	static volatile GType type = 0;
+	static const gchar *tags[] = { NULL };
+
+	if (g_once_init_enter(&type)) {
+		GType _type = gst_meta_api_type_register("GstMMALSrcPyramidMetaAPI",
+				tags);
+		g_once_init_leave(&type, _type);
+	}
+	return type;
+}
+
+static gboolean gst_mmalsrc_pyramid_meta_init(GstMeta *meta, gpointer params,
+		GstBuffer *buffer) {
+	GstMMALSrcPyramidMeta *pmeta = (GstMMALSrcPyramidMeta *) meta;
+
+	pmeta->levels = NULL;
+	pmeta->n_levels = 0;
+	return TRUE;
+}
+
+static void gst_mmalsrc_pyramid_meta_free(GstMeta *meta, GstBuffer *buffer) {
+	GstMMALSrcPyramidMeta *pmeta = (GstMMALSrcPyramidMeta *) meta;
+
+	/* Back to the pool of mmalsrc with the last reference */
+	if (pmeta->levels)
+		gst_buffer_unref(pmeta->levels);
+}
+
+static gboolean gst_mmalsrc_pyramid_meta_transform(GstBuffer *dest,
+		GstMeta *meta, GstBuffer *buffer, GQuark type, gpointer data) {
+	GstMMALSrcPyramidMeta *smeta = (GstMMALSrcPyramidMeta *) meta;
+	GstMMALSrcPyramidMeta *dmeta;
+	guint i;
+
+	/* Levels only describe the whole frame */
+	if (!GST_META_TRANSFORM_IS_COPY(type) || !smeta->levels)
+		return FALSE;
+
+	dmeta = gst_buffer_add_mmalsrc_pyramid_meta(dest,
+			gst_buffer_ref(smeta->levels));
+	if (!dmeta)
+		return FALSE;
+
+	dmeta->n_levels = smeta->n_levels;
+	for (i = 0; i < smeta->n_levels; i++) {
+		dmeta->width[i] = smeta->width[i];
+		dmeta->height[i] = smeta->height[i];
+		dmeta->stride[i] = smeta->stride[i];
+		dmeta->offset[i] = smeta->offset[i];
+	}
+	return TRUE;
+}
+
+const GstMetaInfo *gst_mmalsrc_pyramid_meta_get_info(void) {
+	static const GstMetaInfo *meta_info = NULL;
+
+	if (g_once_init_enter(&meta_info)) {
+		const GstMetaInfo *mi = gst_meta_register(
+				GST_MMALSRC_PYRAMID_META_API_TYPE, "GstMMALSrcPyramidMeta",
+				sizeof(GstMMALSrcPyramidMeta), gst_mmalsrc_pyramid_meta_init,
+				gst_mmalsrc_pyramid_meta_free,
+				gst_mmalsrc_pyramid_meta_transform);
+		g_once_init_leave(&meta_info, mi);
+	}
+	return meta_info;
+}
+
+GstMMALSrcPyramidMeta *gst_buffer_add_mmalsrc_pyramid_meta(GstBuffer *buffer,
+		GstBuffer *levels) {
+	GstMMALSrcPyramidMeta *meta = (GstMMALSrcPyramidMeta *) gst_buffer_add_meta(
+			buffer, GST_MMALSRC_PYRAMID_META_INFO, NULL);
+
+	if (!meta) {
+		gst_buffer_unref(levels);
+		return NULL;
+	}
+
+	meta->levels = levels;
+	return meta;
+}
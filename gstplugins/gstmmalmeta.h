@@ -0,0 +1,86 @@
+/* Smile MMALSRC GStreamer element
+ * Copyright (C) 2017 Alexandra Hospital <hospital.alex@gmail.com>
+ * Copyright (C) 2017 Fabien Dutuit <fabien.dutuit@smile.fr>
+ *
+ * Metadata attached by mmalsrc to the pushed buffers.
+ */
+
+#ifndef _GST_MMALMETA_H_
+#define _GST_MMALMETA_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Latency tracing
+ *
+ * Monotonic timestamps (g_get_monotonic_time(), microseconds) of a frame
+ * at each stage of mmalsrc, 0 when unknown. A sink can close the loop by
+ * comparing them with its own g_get_monotonic_time().
+ * Downstream elements without this header can look the API type up by
+ * its name, "GstMMALSrcLatencyMetaAPI".
+ */
+#define GST_MMALSRC_LATENCY_META_API_TYPE (gst_mmalsrc_latency_meta_api_get_type())
+#define GST_MMALSRC_LATENCY_META_INFO (gst_mmalsrc_latency_meta_get_info())
+
+typedef struct _GstMMALSrcLatencyMeta GstMMALSrcLatencyMeta;
+
+struct _GstMMALSrcLatencyMeta
+{
+    GstMeta meta;
+
+    gint64 sensor;   /* start of frame on the sensor */
+    gint64 callback; /* frame given by VideoCore to the port callback */
+    gint64 dequeue;  /* frame taken by the streaming thread */
+    gint64 push;     /* buffer pushed out of the src pad */
+};
+
+GType gst_mmalsrc_latency_meta_api_get_type (void);
+const GstMetaInfo *gst_mmalsrc_latency_meta_get_info (void);
+
+#define gst_buffer_get_mmalsrc_latency_meta(b) \
+    ((GstMMALSrcLatencyMeta*)gst_buffer_get_meta((b),GST_MMALSRC_LATENCY_META_API_TYPE))
+
+GstMMALSrcLatencyMeta *gst_buffer_add_mmalsrc_latency_meta (GstBuffer *buffer);
+
+/* Luma pyramid
+ *
+ * Downscaled 8-bit luma of the frame, pushed with it: the Y plane for
+ * YUV formats, the green channel for RGBA and BGRA which have no luma.
+ * Level i (0 for 1/2 scale) is width[i] x height[i] samples at
+ * offset[i] in levels, stride[i] bytes per line. levels comes from a pool of mmalsrc and
+ * goes back to it with the last meta referencing it.
+ * API type name "GstMMALSrcPyramidMetaAPI".
+ */
+#define GST_MMALSRC_PYRAMID_MAX_LEVELS 3
+
+#define GST_MMALSRC_PYRAMID_META_API_TYPE (gst_mmalsrc_pyramid_meta_api_get_type())
+#define GST_MMALSRC_PYRAMID_META_INFO (gst_mmalsrc_pyramid_meta_get_info())
+
+typedef struct _GstMMALSrcPyramidMeta GstMMALSrcPyramidMeta;
+
+struct _GstMMALSrcPyramidMeta
+{
+    GstMeta meta;
+
+    GstBuffer *levels;       /* samples of every level, Y or green */
+    guint n_levels;
+    guint width[GST_MMALSRC_PYRAMID_MAX_LEVELS];
+    guint height[GST_MMALSRC_PYRAMID_MAX_LEVELS];
+    guint stride[GST_MMALSRC_PYRAMID_MAX_LEVELS];
+    gsize offset[GST_MMALSRC_PYRAMID_MAX_LEVELS];
+};
+
+GType gst_mmalsrc_pyramid_meta_api_get_type (void);
+const GstMetaInfo *gst_mmalsrc_pyramid_meta_get_info (void);
+
+#define gst_buffer_get_mmalsrc_pyramid_meta(b) \
+    ((GstMMALSrcPyramidMeta*)gst_buffer_get_meta((b),GST_MMALSRC_PYRAMID_META_API_TYPE))
+
+/* Takes ownership of levels */
+GstMMALSrcPyramidMeta *gst_buffer_add_mmalsrc_pyramid_meta (GstBuffer *buffer,
+    GstBuffer *levels);
+
+G_END_DECLS
+
+#endif /* _GST_MMALMETA_H_ */
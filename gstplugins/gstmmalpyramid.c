@@ -0,0 +1,179 @@
+/* Smile MMALSRC GStreamer element
+ * Copyright (C) 2017 Alexandra Hospital <hospital.alex@gmail.com>
+ * Copyright (C) 2017 Fabien Dutuit <fabien.dutuit@smile.fr>
+ *
+ * Luma pyramid : 1/2, 1/4 and 1/8 scale 8-bit levels of a frame.
+ */
+
+#include "gstmmalpyramid.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MMAL_PYRAMID_NEON 1
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define MMAL_PYRAMID_SSSE3 1
+#endif
+
+/******************************************************************
+ * Plain C
+ ******************************************************************/
+
+/******************************************************************
+ * pyramid_line_c
+ * Downscale samples [x, width) of a line.
+ ******************************************************************/
+static void pyramid_line_c(const uint8_t *src0, const uint8_t *src1,
+		uint8_t *dst, unsigned int x, unsigned int width, unsigned int step,
+		unsigned int filter) {
+	if (filter == MMAL_PYRAMID_FILTER_NEAREST) {
+		for (; x < width; x++)
+			dst[x] = src0[2 * x * step];
+		return;
+	}
+
+	for (; x < width; x++) {
+		const uint8_t *a = src0 + 2 * x * step;
+		const uint8_t *b = src1 + 2 * x * step;
+
+		dst[x] = (a[0] + a[step] + b[0] + b[step] + 2) >> 2;
+	}
+}
+
+void gst_mmal_pyramid_line_c(const uint8_t *src0, const uint8_t *src1,
+		uint8_t *dst, unsigned int width, unsigned int step,
+		unsigned int filter) {
+	pyramid_line_c(src0, src1, dst, 0, width, step, filter);
+}
+
+/******************************************************************
+ * SIMD
+ *
+ * Box filter only. Each step gathers 16 consecutive samples of both
+ * lines (16, 32 or 64 bytes depending on step), adds them pairwise on
+ * 16-bit lanes and stores the 8 rounded means.
+ * Interleaved lines stop one output early so that the last load never
+ * goes past the last sample of the line.
+ ******************************************************************/
+
+#if defined(MMAL_PYRAMID_NEON)
+
+static inline uint8x16_t pyramid_load(const uint8_t *src, unsigned int step) {
+	if (step == 4)
+		return vld4q_u8(src).val[0];
+	if (step == 2)
+		return vld2q_u8(src).val[0];
+	return vld1q_u8(src);
+}
+
+static unsigned int pyramid_line_simd(const uint8_t *src0,
+		const uint8_t *src1, uint8_t *dst, unsigned int width,
+		unsigned int step) {
+	unsigned int x;
+
+	for (x = 0; x + 8 + (step > 1) <= width; x += 8) {
+		uint16x8_t sum = vaddq_u16(vpaddlq_u8(pyramid_load(src0 + 2 * x * step,
+				step)), vpaddlq_u8(pyramid_load(src1 + 2 * x * step, step)));
+
+		vst1_u8(dst + x, vrshrn_n_u16(sum, 2));
+	}
+	return x;
+}
+
+#elif defined(MMAL_PYRAMID_SSSE3)
+
+static inline __m128i pyramid_load(const uint8_t *src, unsigned int step) {
+	const __m128i *s = (const __m128i *) src;
+	__m128i idx;
+
+	if (step == 1)
+		return _mm_loadu_si128(s);
+
+	if (step == 2) {
+		idx = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+				-1, -1, -1, -1, -1, -1, -1, -1);
+		return _mm_unpacklo_epi64(_mm_shuffle_epi8(_mm_loadu_si128(s), idx),
+				_mm_shuffle_epi8(_mm_loadu_si128(s + 1), idx));
+	}
+
+	idx = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1);
+	return _mm_unpacklo_epi64(
+			_mm_unpacklo_epi32(_mm_shuffle_epi8(_mm_loadu_si128(s), idx),
+					_mm_shuffle_epi8(_mm_loadu_si128(s + 1), idx)),
+			_mm_unpacklo_epi32(_mm_shuffle_epi8(_mm_loadu_si128(s + 2), idx),
+					_mm_shuffle_epi8(_mm_loadu_si128(s + 3), idx)));
+}
+
+static unsigned int pyramid_line_simd(const uint8_t *src0,
+		const uint8_t *src1, uint8_t *dst, unsigned int width,
+		unsigned int step) {
+	const __m128i ones = _mm_set1_epi8(1);
+	const __m128i round = _mm_set1_epi16(2);
+	unsigned int x;
+
+	for (x = 0; x + 8 + (step > 1) <= width; x += 8) {
+		/* Unsigned samples times 1 : pairwise sums on 16-bit lanes */
+		__m128i sum = _mm_add_epi16(
+				_mm_maddubs_epi16(pyramid_load(src0 + 2 * x * step, step), ones),
+				_mm_maddubs_epi16(pyramid_load(src1 + 2 * x * step, step), ones));
+
+		sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+		_mm_storel_epi64((__m128i *) (dst + x), _mm_packus_epi16(sum, sum));
+	}
+	return x;
+}
+
+#else
+
+static unsigned int pyramid_line_simd(const uint8_t *src0,
+		const uint8_t *src1, uint8_t *dst, unsigned int width,
+		unsigned int step) {
+	return 0;
+}
+
+#endif
+
+/******************************************************************
+ * gst_mmal_pyramid_line
+ ******************************************************************/
+void gst_mmal_pyramid_line(const uint8_t *src0, const uint8_t *src1,
+		uint8_t *dst, unsigned int width, unsigned int step,
+		unsigned int filter) {
+	unsigned int x = 0;
+
+	if (filter == MMAL_PYRAMID_FILTER_BOX)
+		x = pyramid_line_simd(src0, src1, dst, width, step);
+
+	pyramid_line_c(src0, src1, dst, x, width, step, filter);
+}
+
+/******************************************************************
+ * gst_mmal_pyramid_build
+ ******************************************************************/
+void gst_mmal_pyramid_build(const uint8_t *src, unsigned int stride,
+		unsigned int step, unsigned int width, unsigned int height,
+		uint8_t *const dst[], const unsigned int dst_stride[],
+		unsigned int levels, unsigned int filter) {
+	unsigned int strip = 1u << levels;
+	unsigned int y, l, r, last;
+
+	for (y = 0; y < height; y += strip) {
+		for (l = 1; l <= levels; l++) {
+			/* Lines of level l - 1 read from this strip are already built */
+			const uint8_t *in = l == 1 ? src : dst[l - 2];
+			unsigned int in_stride = l == 1 ? stride : dst_stride[l - 2];
+			unsigned int in_step = l == 1 ? step : 1;
+
+			last = (y + strip) >> l;
+			if (last > height >> l)
+				last = height >> l;
+
+			for (r = y >> l; r < last; r++)
+				gst_mmal_pyramid_line(in + 2 * r * in_stride,
+						in + (2 * r + 1) * in_stride,
+						dst[l - 1] + r * dst_stride[l - 1], width >> l, in_step,
+						filter);
+		}
+	}
+}
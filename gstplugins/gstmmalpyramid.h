@@ -0,0 +1,58 @@
+/* Smile MMALSRC GStreamer element
+ * Copyright (C) 2017 Alexandra Hospital <hospital.alex@gmail.com>
+ * Copyright (C) 2017 Fabien Dutuit <fabien.dutuit@smile.fr>
+ *
+ * Luma pyramid : 1/2, 1/4 and 1/8 scale 8-bit levels of a frame.
+ * Only depends on the C library, so it can be checked on any host
+ * against reference data.
+ */
+
+#ifndef _GST_MMALPYRAMID_H_
+#define _GST_MMALPYRAMID_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Levels below the frame, level l is (width >> l) x (height >> l) */
+#define MMAL_PYRAMID_MAX_LEVELS 3
+
+/* Downscale filters */
+#define MMAL_PYRAMID_FILTER_BOX 0     /* rounded mean of each 2x2 block */
+#define MMAL_PYRAMID_FILTER_NEAREST 1 /* top left sample of each 2x2 block */
+
+/*
+ * Downscale two lines into one of width samples.
+ *
+ * src0, src1 : lines 2y and 2y + 1 of the level above, the samples
+ *              step bytes apart (1, 2 or 4 for interleaved formats)
+ * dst        : line y of the level, 8-bit samples
+ */
+void gst_mmal_pyramid_line(const uint8_t *src0, const uint8_t *src1,
+		uint8_t *dst, unsigned int width, unsigned int step,
+		unsigned int filter);
+
+/* Plain C version of gst_mmal_pyramid_line, reference for the SIMD paths */
+void gst_mmal_pyramid_line_c(const uint8_t *src0, const uint8_t *src1,
+		uint8_t *dst, unsigned int width, unsigned int step,
+		unsigned int filter);
+
+/*
+ * Build levels 1 to levels of a width x height plane in one pass.
+ *
+ * The frame is walked in strips of 2^levels lines and every level of a
+ * strip is built while the lines above it are still in the cache.
+ * dst[l - 1] receives level l, dst_stride[l - 1] bytes per line.
+ */
+void gst_mmal_pyramid_build(const uint8_t *src, unsigned int stride,
+		unsigned int step, unsigned int width, unsigned int height,
+		uint8_t *const dst[], const unsigned int dst_stride[],
+		unsigned int levels, unsigned int filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _GST_MMALPYRAMID_H_ */
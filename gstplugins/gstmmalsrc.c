@@ -17,6 +17,10 @@
  * </refsect2>
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <gst/gst.h>
 #include <gst/base/gstpushsrc.h>
 #include <gst/video/video.h>
@@ -32,10 +36,16 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/eventfd.h>
 #include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "bcm_host.h"
 #include "gstmmalsrc.h"
+#include "gstmmalunpack.h"
+#include "gstmmalmeta.h"
 
 #include "interface/vcos/vcos.h"
 
@@ -59,9 +69,21 @@ static void gst_mmalsrc_finalize(GObject * object);
 static gboolean gst_mmalsrc_unlock(GstBaseSrc * src);
 static gboolean gst_mmalsrc_unlock_stop(GstBaseSrc * src);
 
+static GstCaps *gst_mmalsrc_get_caps(GstBaseSrc * src, GstCaps * filter);
 static GstCaps *gst_mmalsrc_fixate(GstBaseSrc * src, GstCaps * caps);
 static gboolean gst_mmalsrc_set_caps(GstBaseSrc * src, GstCaps * caps);
+static gboolean gst_mmalsrc_set_bayer_caps(GstMMALSrc * mmalsrc,
+		GstStructure * structure);
 static gboolean gst_mmalsrc_is_seekable(GstBaseSrc * src);
+static gboolean gst_mmalsrc_query(GstBaseSrc * src, GstQuery * query);
+static void gst_mmalsrc_burst(GstMMALSrc * mmalsrc, guint frames);
+static void gst_mmalsrc_flush_preroll(GstMMALSrc * mmalsrc);
+static void gst_mmalsrc_preroll_keep(GstMMALSrc * mmalsrc,
+		MMAL_BUFFER_HEADER_T * buffer_h, gint64 dequeue);
+static GstPadProbeReturn gst_mmalsrc_preroll_probe(GstPad * pad,
+		GstPadProbeInfo * info, gpointer user_data);
+static void gst_mmalsrc_port_teardown(GstMMALSrc * mmalsrc);
+static void gst_mmalsrc_capture_setup(GstMMALSrc * mmalsrc);
 static GstFlowReturn gst_mmalsrc_create(GstPushSrc * psrc,
 		GstBuffer ** outbuf);
 
@@ -73,16 +95,118 @@ enum {
 	PROP_SHUTTER_ACTIVATION,
 	PROP_SHUTTER_PERIOD,
 	PROP_ISO,
-	PROP_EXPOSURE
+	PROP_EXPOSURE,
+	PROP_MOTION_GATE,
+	PROP_MOTION_THRESHOLD,
+	PROP_MOTION_HEARTBEAT,
+	PROP_MOTION_HYSTERESIS,
+	PROP_OUTPUT_RATE,
+	PROP_SENSOR_RATE,
+	PROP_ALLOW_BURST,
+	PROP_CAPTURE_MODE,
+	PROP_CAPTURE_CPU,
+	PROP_CAPTURE_PRIORITY,
+	PROP_STREAMING_CPU,
+	PROP_STREAMING_PRIORITY,
+	PROP_BAYER_BITS,
+	PROP_BAYER_SHIFT,
+	PROP_BAYER_THREADS,
+	PROP_LATENCY_TRACING,
+	PROP_LATENCY_REPORT,
+	PROP_POOL_ADAPTIVE,
+	PROP_POOL_MIN,
+	PROP_POOL_MAX,
+	PROP_POOL_MEMORY_BUDGET,
+	PROP_POOL_SIZE,
+	PROP_WATCHDOG_FRAMES,
+	PROP_STEREO_MODE,
+	PROP_STEREO_TOLERANCE,
+	PROP_BATCH_SIZE,
+	PROP_BATCH_LATENCY,
+	PROP_PYRAMID_LEVELS,
+	PROP_PYRAMID_FILTER,
+	PROP_PREROLL_DURATION,
+	PROP_PREROLL_MEMORY,
+	PROP_PREROLL_SUBSAMPLE,
+	PROP_PREROLL_HOLD
+};
+
+enum {
+	SIGNAL_BURST,
+	SIGNAL_FLUSH_PREROLL,
+	LAST_SIGNAL
 };
 
+static guint gst_mmalsrc_signals[LAST_SIGNAL] = { 0 };
+
+#define GST_TYPE_MMALSRC_MOTION_GATE (gst_mmalsrc_motion_gate_get_type())
+static GType gst_mmalsrc_motion_gate_get_type(void) {
+	static volatile GType type = 0;
+	static const GEnumValue values[] = {
+		{ MMALSRC_MOTION_GATE_OFF, "Push every frame", "off" },
+		{ MMALSRC_MOTION_GATE_DROP, "Recycle static frames", "drop" },
+		{ MMALSRC_MOTION_GATE_TAG, "Flag static frames droppable", "tag" },
+		{ 0, NULL, NULL }
+	};
+
+	if (g_once_init_enter(&type)) {
+		GType _type = g_enum_register_static("GstMMALSrcMotionGate", values);
+		g_once_init_leave(&type, _type);
+	}
+	return type;
+}
+
+#define GST_TYPE_MMALSRC_PYRAMID_FILTER (gst_mmalsrc_pyramid_filter_get_type())
+static GType gst_mmalsrc_pyramid_filter_get_type(void) {
+	static volatile GType type = 0;
+	static const GEnumValue values[] = {
+		{ MMALSRC_PYRAMID_FILTER_BOX, "Mean of 2x2 blocks", "box" },
+		{ MMALSRC_PYRAMID_FILTER_NEAREST, "One sample per 2x2 block",
+				"nearest" },
+		{ 0, NULL, NULL }
+	};
+
+	if (g_once_init_enter(&type)) {
+		GType _type = g_enum_register_static("GstMMALSrcPyramidFilter",
+				values);
+		g_once_init_leave(&type, _type);
+	}
+	return type;
+}
+
+/*
+ * <order>10p and <order>12p Bayer formats are private to this element :
+ * MIPI CSI-2 RAW10/RAW12 lines (see gstmmalunpack.h), which no
+ * upstream GStreamer element understands.
+ * Bayer frames are still captures requested one by one, at no fixed
+ * rate : their framerate is 0/1.
+ */
 #define MMAL_VIDEO_CAPS \
   "video/x-raw, "                 									\
   "format = (string) { I420, RGBA, BGRA, YV12, YVYU, UYVY }, "      \
   "width = (int) [ 1, 1920 ], "     								\
   "height = (int) [ 1, 1080 ], "      								\
   "pixel-aspect-ratio = 1/1, "       								\
-  "framerate = (fraction) [ 0/1, 90/1 ]"
+  "framerate = (fraction) [ 0/1, 90/1 ]; "							\
+  "video/x-bayer, "													\
+  "format = (string) { bggr16le, gbrg16le, grbg16le, rggb16le, "	\
+  "bggr, gbrg, grbg, rggb, bggr10p, gbrg10p, grbg10p, rggb10p, "	\
+  "bggr12p, gbrg12p, grbg12p, rggb12p }, "							\
+  "width = (int) [ 1, 4056 ], "										\
+  "height = (int) [ 1, 3040 ], "									\
+  "framerate = (fraction) 0/1"
+
+/* Bayer orders and their packed MMAL encodings */
+static const struct {
+	const gchar *order;
+	MMAL_FOURCC_T encoding_10;
+	MMAL_FOURCC_T encoding_12;
+} bayer_orders[] = {
+	{ "bggr", MMAL_ENCODING_BAYER_SBGGR10P, MMAL_ENCODING_BAYER_SBGGR12P },
+	{ "gbrg", MMAL_ENCODING_BAYER_SGBRG10P, MMAL_ENCODING_BAYER_SGBRG12P },
+	{ "grbg", MMAL_ENCODING_BAYER_SGRBG10P, MMAL_ENCODING_BAYER_SGRBG12P },
+	{ "rggb", MMAL_ENCODING_BAYER_SRGGB10P, MMAL_ENCODING_BAYER_SRGGB12P },
+};
 
 static GstStaticPadTemplate gst_mmalsrc_src_template =
 GST_STATIC_PAD_TEMPLATE ("src",
@@ -93,6 +217,17 @@ GST_STATIC_PAD_TEMPLATE ("src",
 
 static VCOS_EVENT_FLAGS_T events;
 
+/* Retired pools against the release of their headers downstream */
+static GMutex retired_lock;
+
+/* Buffer mark of the segment the pre-event probe pushes ahead of it */
+static GQuark preroll_quark;
+
+typedef enum {
+	MMALSRC_PREROLL_FLUSH = 1,  /* first flushed frame : segment of the flush */
+	MMALSRC_PREROLL_RESUME      /* first live frame after : stream segment */
+} GstMMALSrcPrerollMark;
+
 typedef enum {
 	MMAL_CAM_BUFFER_READY = 1 << 0,
 	MMAL_CAM_AUTOFOCUS_COMPLETE = 1 << 1,
@@ -102,6 +237,162 @@ typedef enum {
 G_DEFINE_TYPE_WITH_CODE(GstMMALSrc, gst_mmalsrc, GST_TYPE_PUSH_SRC,
 		GST_DEBUG_CATEGORY_INIT (gst_mmalsrc_debug_category, "mmalsrc", 3, "debug category for mmalsrc element"))
 
+/******************************************************************
+ ******************************************************************
+ ****** Capture threads *******************************************
+ *****************************************************************
+ ******************************************************************/
+
+/******************************************************************
+ * gst_mmalsrc_thread_setup
+ * Pin the calling thread on a CPU and give it a SCHED_FIFO priority.
+ * cpu < 0 and priority 0 leave the thread untouched.
+ ******************************************************************/
+static void gst_mmalsrc_thread_setup(const gchar *name, gint cpu,
+		guint priority) {
+	pthread_t self = pthread_self();
+	int err;
+
+	if (cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		err = pthread_setaffinity_np(self, sizeof(cpus), &cpus);
+		if (err)
+			GST_WARNING("%s thread: couldn't pin on CPU %d : %s", name, cpu,
+					strerror(err));
+		else
+			GST_INFO("%s thread pinned on CPU %d", name, cpu);
+	}
+
+	if (priority > 0) {
+		struct sched_param param;
+
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority;
+		err = pthread_setschedparam(self, SCHED_FIFO, &param);
+		if (err)
+			GST_WARNING("%s thread: couldn't set SCHED_FIFO %d : %s", name,
+					priority, strerror(err));
+		else
+			GST_INFO("%s thread set to SCHED_FIFO %d", name, priority);
+	}
+}
+
+/******************************************************************
+ * gst_mmalsrc_thread_save
+ * Save the affinity and scheduling of the calling thread.
+ ******************************************************************/
+static gboolean gst_mmalsrc_thread_save(cpu_set_t *cpus, int *policy,
+		struct sched_param *param) {
+	pthread_t self = pthread_self();
+
+	return pthread_getaffinity_np(self, sizeof(*cpus), cpus) == 0
+			&& pthread_getschedparam(self, policy, param) == 0;
+}
+
+/******************************************************************
+ * gst_mmalsrc_streaming_leave
+ * Task leave callback, give the streaming thread its settings back
+ * before it returns to the GStreamer thread pool.
+ ******************************************************************/
+static void gst_mmalsrc_streaming_leave(GstTask *task, GThread *thread,
+		gpointer user_data) {
+	GstMMALSrc *mmalsrc = (GstMMALSrc *) user_data;
+	pthread_t self = pthread_self();
+
+	if (!mmalsrc->streaming_saved)
+		return;
+
+	if (pthread_setaffinity_np(self, sizeof(mmalsrc->streaming_cpus),
+			&mmalsrc->streaming_cpus)
+			|| pthread_setschedparam(self, mmalsrc->streaming_policy,
+					&mmalsrc->streaming_param))
+		GST_WARNING("streaming thread: couldn't restore its settings");
+	else
+		GST_INFO("streaming thread settings restored");
+
+	mmalsrc->streaming_saved = FALSE;
+	mmalsrc->streaming_thread_ready = FALSE;
+}
+
+/******************************************************************
+ * gst_mmalsrc_streaming_setup
+ * Pin the streaming thread and raise its priority, from create. Its
+ * settings are saved first and restored when the task stops.
+ ******************************************************************/
+static void gst_mmalsrc_streaming_setup(GstMMALSrc *mmalsrc) {
+	GstTask *task;
+
+	mmalsrc->streaming_thread_ready = TRUE;
+	if (mmalsrc->streaming_cpu < 0 && !mmalsrc->streaming_priority)
+		return;
+
+	task = GST_PAD_TASK(GST_BASE_SRC_PAD(mmalsrc));
+	if (!task || !gst_mmalsrc_thread_save(&mmalsrc->streaming_cpus,
+			&mmalsrc->streaming_policy, &mmalsrc->streaming_param)) {
+		GST_WARNING("streaming thread: settings left untouched");
+		return;
+	}
+
+	mmalsrc->streaming_saved = TRUE;
+	gst_task_set_leave_callback(task, gst_mmalsrc_streaming_leave, mmalsrc,
+			NULL);
+	gst_mmalsrc_thread_setup("streaming", mmalsrc->streaming_cpu,
+			mmalsrc->streaming_priority);
+}
+
+/******************************************************************
+ * gst_mmalsrc_ring_put
+ * Producer side, only called from the camera port callback.
+ * Return FALSE if the ring is full.
+ ******************************************************************/
+static gboolean gst_mmalsrc_ring_put(GstMMALSrcRing *ring,
+		MMAL_BUFFER_HEADER_T *buffer) {
+	guint head = (guint) g_atomic_int_get(&ring->head);
+	guint tail = (guint) g_atomic_int_get(&ring->tail);
+
+	if (head - tail >= MMALSRC_RING_SIZE)
+		return FALSE;
+
+	ring->slots[head & (MMALSRC_RING_SIZE - 1)] = buffer;
+	/* Publish the slot after it is written */
+	g_atomic_int_set(&ring->head, (gint) (head + 1));
+	return TRUE;
+}
+
+/******************************************************************
+ * gst_mmalsrc_ring_get
+ * Consumer side, only called from the streaming thread.
+ * Return NULL if the ring is empty.
+ ******************************************************************/
+static MMAL_BUFFER_HEADER_T *gst_mmalsrc_ring_get(GstMMALSrcRing *ring) {
+	guint tail = (guint) g_atomic_int_get(&ring->tail);
+	guint head = (guint) g_atomic_int_get(&ring->head);
+	MMAL_BUFFER_HEADER_T *buffer;
+
+	if (head == tail)
+		return NULL;
+
+	buffer = ring->slots[tail & (MMALSRC_RING_SIZE - 1)];
+	/* Give the slot back once it is read */
+	g_atomic_int_set(&ring->tail, (gint) (tail + 1));
+	return buffer;
+}
+
+/******************************************************************
+ * gst_mmalsrc_ring_wakeup
+ * Wake the streaming thread up if it waits on the ring.
+ ******************************************************************/
+static void gst_mmalsrc_ring_wakeup(GstMMALSrc *mmalsrc) {
+	uint64_t one = 1;
+
+	if (mmalsrc->ring_fd >= 0
+			&& write(mmalsrc->ring_fd, &one, sizeof(one)) != sizeof(one))
+		GST_WARNING("ring wakeup failed : %s", strerror(errno));
+}
+
 /******************************************************************
  ******************************************************************
  ****** Callbacks *************************************************
@@ -144,20 +435,124 @@ static void control_bh_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
  ******************************************************************/
 static void generic_output_port_cb(MMAL_PORT_T *port,
 		MMAL_BUFFER_HEADER_T *buffer) {
+	GstMMALSrc *mmalsrc = (GstMMALSrc *) port->userdata;
 
 	if (buffer->cmd != 0) {
 		GST_INFO("%s callback: event %u not supported", port->name,
 				buffer->cmd);
 		mmal_buffer_header_release(buffer);
-	} else {
-		MMAL_QUEUE_T *queue = (MMAL_QUEUE_T *) port->userdata;
-		GST_INFO("%s callback", port->name);
-		mmal_queue_put(queue, buffer);
+		return;
+	}
+
+	/* Every frame, traced or not : it is also the buffer timestamp */
+	if (buffer->user_data)
+		((GstMMALSrcHeaderInfo *) buffer->user_data)->callback =
+				g_get_monotonic_time();
+
+	GST_INFO("%s callback", port->name);
+
+	/* Headers a port disable gives back empty go straight home */
+	if (buffer->length == 0) {
+		mmal_buffer_header_release(buffer);
+		return;
+	}
+
+	/* Ring mode : the callback is the single producer of the ring */
+	if (mmalsrc->use_ring) {
+		if (!mmalsrc->capture_ready)
+			gst_mmalsrc_capture_setup(mmalsrc);
+
+		if (!gst_mmalsrc_ring_put(&mmalsrc->ring, buffer)) {
+			GST_WARNING("%s callback: frame ring full", port->name);
+			mmal_buffer_header_release(buffer);
+			return;
+		}
+		gst_mmalsrc_ring_wakeup(mmalsrc);
+		return;
 	}
 
+	mmal_queue_put(mmalsrc->queue_video_frames, buffer);
 	vcos_event_flags_set(&events, MMAL_CAM_BUFFER_READY, VCOS_OR);
 }
 
+/******************************************************************
+ * gst_mmalsrc_capture_setup
+ * From the first callback of the ring mode, pin the MMAL callback
+ * thread and raise its priority. Its settings are saved first and
+ * given back by gst_mmalsrc_capture_restore.
+ ******************************************************************/
+static void gst_mmalsrc_capture_setup(GstMMALSrc *mmalsrc) {
+	mmalsrc->capture_ready = TRUE;
+	if (mmalsrc->capture_cpu < 0 && !mmalsrc->capture_priority)
+		return;
+
+	if (!gst_mmalsrc_thread_save(&mmalsrc->capture_cpus,
+			&mmalsrc->capture_policy, &mmalsrc->capture_param)) {
+		GST_WARNING("capture thread: settings left untouched");
+		return;
+	}
+
+	mmalsrc->capture_thread = pthread_self();
+	mmalsrc->capture_saved = TRUE;
+	gst_mmalsrc_thread_setup("capture", mmalsrc->capture_cpu,
+			mmalsrc->capture_priority);
+}
+
+/******************************************************************
+ * gst_mmalsrc_capture_restore
+ * Once the camera port is disabled, give the MMAL callback thread,
+ * shared with the rest of the process, its settings back.
+ ******************************************************************/
+static void gst_mmalsrc_capture_restore(GstMMALSrc *mmalsrc) {
+	if (mmalsrc->capture_saved) {
+		if (pthread_setaffinity_np(mmalsrc->capture_thread,
+				sizeof(mmalsrc->capture_cpus), &mmalsrc->capture_cpus)
+				|| pthread_setschedparam(mmalsrc->capture_thread,
+						mmalsrc->capture_policy, &mmalsrc->capture_param))
+			GST_WARNING("capture thread: couldn't restore its settings");
+		else
+			GST_INFO("capture thread settings restored");
+		mmalsrc->capture_saved = FALSE;
+	}
+	mmalsrc->capture_ready = FALSE;
+}
+
+/******************************************************************
+ * gst_mmalsrc_port_flush
+ * Once the camera port is disabled, give the callback thread its
+ * settings back and the frames waiting for the streaming thread back
+ * to the pool.
+ ******************************************************************/
+static void gst_mmalsrc_port_flush(GstMMALSrc *mmalsrc) {
+	MMAL_BUFFER_HEADER_T *buffer_h;
+
+	gst_mmalsrc_capture_restore(mmalsrc);
+
+	if (mmalsrc->use_ring)
+		while ((buffer_h = gst_mmalsrc_ring_get(&mmalsrc->ring)) != NULL)
+			mmal_buffer_header_release(buffer_h);
+	while ((buffer_h = mmal_queue_get(mmalsrc->queue_video_frames)) != NULL)
+		mmal_buffer_header_release(buffer_h);
+}
+
+/******************************************************************
+ * second camera output port callback
+ * put buffer into the pair queue
+ ******************************************************************/
+static void gst_mmalsrc_pair_port_cb(MMAL_PORT_T *port,
+		MMAL_BUFFER_HEADER_T *buffer) {
+	GstMMALSrc *mmalsrc = (GstMMALSrc *) port->userdata;
+
+	if (buffer->cmd != 0) {
+		GST_INFO("%s callback: event %u not supported", port->name,
+				buffer->cmd);
+		mmal_buffer_header_release(buffer);
+		return;
+	}
+
+	mmal_queue_put(mmalsrc->queue_pair_frames, buffer);
+}
+
 /******************************************************************
  * gst_mmalsrc_class_init
  * Class initialization
@@ -203,11 +598,246 @@ static void gst_mmalsrc_class_init(GstMMALSrcClass * klass) {
 			g_param_spec_string("exposure", "exposure", "exposure  (on or off)",
 			MMALSRC_DEFAULT_EXPOSURE, G_PARAM_READWRITE));
 
+	g_object_class_install_property(gobject_class, PROP_MOTION_GATE,
+			g_param_spec_enum("motion-gate", "motion-gate",
+					"change detection gating (off, drop static frames or tag them)",
+					GST_TYPE_MMALSRC_MOTION_GATE, MMALSRC_DEFAULT_MOTION_GATE,
+					G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_MOTION_THRESHOLD,
+			g_param_spec_uint("motion-threshold", "motion-threshold",
+					"mean luma difference below which a frame is static", 0, 255,
+					MMALSRC_DEFAULT_MOTION_THRESHOLD, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_MOTION_HEARTBEAT,
+			g_param_spec_uint("motion-heartbeat", "motion-heartbeat",
+					"push a static frame every N frames (0 = never)", 0, G_MAXUINT,
+					MMALSRC_DEFAULT_MOTION_HEARTBEAT, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_MOTION_HYSTERESIS,
+			g_param_spec_uint("motion-hysteresis", "motion-hysteresis",
+					"consecutive static frames before gating starts", 0, G_MAXUINT,
+					MMALSRC_DEFAULT_MOTION_HYSTERESIS, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_OUTPUT_RATE,
+			gst_param_spec_fraction("output-rate", "output-rate",
+					"rate of pushed frames, evenly decimated from the sensor rate"
+					" (0/1 = sensor rate)", 0, 1, G_MAXINT, 1,
+					MMALSRC_DEFAULT_OUTPUT_RATE_NUM,
+					MMALSRC_DEFAULT_OUTPUT_RATE_DEN,
+					G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+
+	g_object_class_install_property(gobject_class, PROP_SENSOR_RATE,
+			gst_param_spec_fraction("sensor-rate", "sensor-rate",
+					"sensor frame rate when output-rate is set, the caps then"
+					" carry the output rate", 1, 1, MMALSRC_MAX_SENSOR_RATE, 1,
+					MMALSRC_DEFAULT_SENSOR_RATE_NUM,
+					MMALSRC_DEFAULT_SENSOR_RATE_DEN,
+					G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+
+	g_object_class_install_property(gobject_class, PROP_ALLOW_BURST,
+			g_param_spec_boolean("allow-burst", "allow-burst",
+					"honour the burst signal, the caps framerate is then"
+					" variable (0/1)", MMALSRC_DEFAULT_ALLOW_BURST,
+					G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_CAPTURE_MODE,
+			g_param_spec_string("capture-mode", "capture-mode",
+					"frame hand-off from the camera callback (queue or ring)",
+					MMALSRC_DEFAULT_CAPTURE_MODE, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_CAPTURE_CPU,
+			g_param_spec_int("capture-cpu", "capture-cpu",
+					"CPU the MMAL callback thread is pinned on in ring mode,"
+					" until the port stops (-1 = any)",
+					-1, CPU_SETSIZE - 1, MMALSRC_DEFAULT_THREAD_CPU,
+					G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_CAPTURE_PRIORITY,
+			g_param_spec_uint("capture-priority", "capture-priority",
+					"SCHED_FIFO priority of the MMAL callback thread in ring"
+					" mode, until the port stops (0 = off)",
+					0, 99, MMALSRC_DEFAULT_THREAD_PRIORITY, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_STREAMING_CPU,
+			g_param_spec_int("streaming-cpu", "streaming-cpu",
+					"CPU the streaming thread is pinned on (-1 = any)",
+					-1, CPU_SETSIZE - 1, MMALSRC_DEFAULT_THREAD_CPU,
+					G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_STREAMING_PRIORITY,
+			g_param_spec_uint("streaming-priority", "streaming-priority",
+					"SCHED_FIFO priority of the streaming thread (0 = off)",
+					0, 99, MMALSRC_DEFAULT_THREAD_PRIORITY, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_BAYER_BITS,
+			g_param_spec_uint("bayer-bits", "bayer-bits",
+					"sensor packing unpacked to 8 or 16-bit Bayer (10 or 12)",
+					10, 12, MMALSRC_DEFAULT_BAYER_BITS, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_BAYER_SHIFT,
+			g_param_spec_int("bayer-shift", "bayer-shift",
+					"right shift of samples for 8-bit Bayer (-1 = keep the MSBs)",
+					-1, 12, MMALSRC_DEFAULT_BAYER_SHIFT, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_BAYER_THREADS,
+			g_param_spec_uint("bayer-threads", "bayer-threads",
+					"threads unpacking raw Bayer frames", 1,
+					MMALSRC_MAX_BAYER_THREADS, MMALSRC_DEFAULT_BAYER_THREADS,
+					G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_LATENCY_TRACING,
+			g_param_spec_string("latency-tracing", "latency-tracing",
+					"per-stage latency timestamps and histograms (on or off)",
+					MMALSRC_DEFAULT_LATENCY_TRACING, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_LATENCY_REPORT,
+			g_param_spec_uint("latency-report", "latency-report",
+					"frames between two mmalsrc-latency messages (0 = never)",
+					0, G_MAXUINT, MMALSRC_DEFAULT_LATENCY_REPORT,
+					G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_POOL_ADAPTIVE,
+			g_param_spec_boolean("pool-adaptive", "pool-adaptive",
+					"size the camera pool from the downstream hold time,"
+					" within pool-min, pool-max and pool-memory-budget",
+					MMALSRC_DEFAULT_POOL_ADAPTIVE, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_POOL_MIN,
+			g_param_spec_uint("pool-min", "pool-min",
+					"fewest camera buffers", 1, MMALSRC_MAX_POOL_SIZE,
+					MMALSRC_DEFAULT_POOL_MIN, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_POOL_MAX,
+			g_param_spec_uint("pool-max", "pool-max",
+					"most camera buffers", 1, MMALSRC_MAX_POOL_SIZE,
+					MMALSRC_DEFAULT_POOL_MAX, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_POOL_MEMORY_BUDGET,
+			g_param_spec_uint64("pool-memory-budget", "pool-memory-budget",
+					"memory cap of the camera buffers in bytes (0 = no cap)",
+					0, G_MAXUINT64, MMALSRC_DEFAULT_POOL_MEMORY_BUDGET,
+					G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_POOL_SIZE,
+			g_param_spec_uint("pool-size", "pool-size",
+					"camera buffers currently in use", 0, G_MAXUINT, 0,
+					G_PARAM_READABLE));
+
+	g_object_class_install_property(gobject_class, PROP_WATCHDOG_FRAMES,
+			g_param_spec_uint("watchdog-frames", "watchdog-frames",
+					"frame periods without a frame before the camera is"
+					" restarted (0 = never)", 0, G_MAXUINT,
+					MMALSRC_DEFAULT_WATCHDOG_FRAMES, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_STEREO_MODE,
+			g_param_spec_string("stereo-mode", "stereo-mode",
+					"stereo capture (off, side-by-side or top-bottom from the"
+					" firmware, pair of cameras 0 and 1)",
+					MMALSRC_DEFAULT_STEREO_MODE, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_STEREO_TOLERANCE,
+			g_param_spec_uint("stereo-tolerance", "stereo-tolerance",
+					"largest timestamp difference of a pair in microseconds",
+					0, G_MAXUINT, MMALSRC_DEFAULT_STEREO_TOLERANCE,
+					G_PARAM_READWRITE));
+
+#if GST_CHECK_VERSION(1,14,0)
+	g_object_class_install_property(gobject_class, PROP_BATCH_SIZE,
+			g_param_spec_uint("batch-size", "batch-size",
+					"most frames pushed in one buffer list (1 = no lists)",
+					1, MMALSRC_MAX_BATCH_SIZE, MMALSRC_DEFAULT_BATCH_SIZE,
+					G_PARAM_READWRITE));
+#else
+	/* Lists need gst_base_src_submit_buffer_list */
+	g_object_class_install_property(gobject_class, PROP_BATCH_SIZE,
+			g_param_spec_uint("batch-size", "batch-size",
+					"most frames pushed in one buffer list, needs GStreamer"
+					" 1.14", 1, 1, MMALSRC_DEFAULT_BATCH_SIZE,
+					G_PARAM_READWRITE));
+#endif
+
+	g_object_class_install_property(gobject_class, PROP_BATCH_LATENCY,
+			g_param_spec_uint("batch-latency", "batch-latency",
+					"wait for more frames of a buffer list in ms (0 = only"
+					" frames already captured)", 0, MMALSRC_MAX_BATCH_LATENCY,
+					MMALSRC_DEFAULT_BATCH_LATENCY, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_PYRAMID_LEVELS,
+			g_param_spec_uint("pyramid-levels", "pyramid-levels",
+					"downscaled luma levels attached to each frame, 1/2, 1/4"
+					" then 1/8 scale (0 = no pyramid)", 0,
+					MMAL_PYRAMID_MAX_LEVELS, MMALSRC_DEFAULT_PYRAMID_LEVELS,
+					G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_PYRAMID_FILTER,
+			g_param_spec_enum("pyramid-filter", "pyramid-filter",
+					"pyramid downscale filter (box or nearest)",
+					GST_TYPE_MMALSRC_PYRAMID_FILTER,
+					MMALSRC_DEFAULT_PYRAMID_FILTER, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_PREROLL_DURATION,
+			g_param_spec_uint("preroll-duration", "preroll-duration",
+					"frames kept for the flush-preroll signal in ms"
+					" (0 = no pre-event ring)", 0, G_MAXUINT,
+					MMALSRC_DEFAULT_PREROLL_DURATION, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_PREROLL_MEMORY,
+			g_param_spec_uint64("preroll-memory", "preroll-memory",
+					"memory cap of the pre-event ring in bytes", 0, G_MAXUINT64,
+					MMALSRC_DEFAULT_PREROLL_MEMORY, G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_PREROLL_SUBSAMPLE,
+			g_param_spec_uint("preroll-subsample", "preroll-subsample",
+					"keep one frame every N in the pre-event ring", 1,
+					G_MAXUINT, MMALSRC_DEFAULT_PREROLL_SUBSAMPLE,
+					G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, PROP_PREROLL_HOLD,
+			g_param_spec_boolean("preroll-hold", "preroll-hold",
+					"hold live frames in the pre-event ring instead of pushing"
+					" them until flush-preroll, setting it again re-arms the"
+					" hold", MMALSRC_DEFAULT_PREROLL_HOLD, G_PARAM_READWRITE));
+
+	/**
+	 * GstMMALSrc::burst:
+	 * @mmalsrc: the mmalsrc
+	 * @frames: number of frames
+	 *
+	 * Action signal pushing the next @frames sensor frames at full rate,
+	 * bypassing decimation and change detection.
+	 */
+	gst_mmalsrc_signals[SIGNAL_BURST] = g_signal_new("burst",
+			G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+			G_STRUCT_OFFSET(GstMMALSrcClass, burst), NULL, NULL, NULL,
+			G_TYPE_NONE, 1, G_TYPE_UINT);
+
+	klass->burst = gst_mmalsrc_burst;
+
+	/**
+	 * GstMMALSrc::flush-preroll:
+	 * @mmalsrc: the mmalsrc
+	 *
+	 * Action signal pushing the frames of the pre-event ring, with their
+	 * original timestamps and in a segment of their own, ahead of the
+	 * next live frame, which restores the stream segment. Ends the hold
+	 * of preroll-hold.
+	 */
+	gst_mmalsrc_signals[SIGNAL_FLUSH_PREROLL] = g_signal_new("flush-preroll",
+			G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+			G_STRUCT_OFFSET(GstMMALSrcClass, flush_preroll), NULL, NULL, NULL,
+			G_TYPE_NONE, 0);
+
+	klass->flush_preroll = gst_mmalsrc_flush_preroll;
+	preroll_quark = g_quark_from_static_string("GstMMALSrcPrerollMark");
+
+	base_src_class->get_caps = GST_DEBUG_FUNCPTR(gst_mmalsrc_get_caps);
 	base_src_class->fixate = GST_DEBUG_FUNCPTR(gst_mmalsrc_fixate);
 	base_src_class->set_caps = GST_DEBUG_FUNCPTR(gst_mmalsrc_set_caps);
 	base_src_class->start = GST_DEBUG_FUNCPTR(gst_mmalsrc_start);
 	base_src_class->stop = GST_DEBUG_FUNCPTR(gst_mmalsrc_stop);
 	base_src_class->is_seekable = GST_DEBUG_FUNCPTR(gst_mmalsrc_is_seekable);
+	base_src_class->query = GST_DEBUG_FUNCPTR(gst_mmalsrc_query);
 	base_src_class->unlock = GST_DEBUG_FUNCPTR(gst_mmalsrc_unlock);
 	base_src_class->unlock_stop = GST_DEBUG_FUNCPTR(gst_mmalsrc_unlock_stop);
 
@@ -224,6 +854,44 @@ static void gst_mmalsrc_init(GstMMALSrc *mmalsrc) {
 	mmalsrc->shutter_period = MMALSRC_DEFAULT_SHUTTER_PERIOD;
 	mmalsrc->iso = MMALSRC_DEFAULT_ISO;
 	mmalsrc->exposure = g_strdup(MMALSRC_DEFAULT_EXPOSURE);
+	mmalsrc->motion_gate = MMALSRC_DEFAULT_MOTION_GATE;
+	mmalsrc->motion_threshold = MMALSRC_DEFAULT_MOTION_THRESHOLD;
+	mmalsrc->motion_heartbeat = MMALSRC_DEFAULT_MOTION_HEARTBEAT;
+	mmalsrc->motion_hysteresis = MMALSRC_DEFAULT_MOTION_HYSTERESIS;
+	mmalsrc->output_rate_num = MMALSRC_DEFAULT_OUTPUT_RATE_NUM;
+	mmalsrc->output_rate_den = MMALSRC_DEFAULT_OUTPUT_RATE_DEN;
+	mmalsrc->sensor_rate_num = MMALSRC_DEFAULT_SENSOR_RATE_NUM;
+	mmalsrc->sensor_rate_den = MMALSRC_DEFAULT_SENSOR_RATE_DEN;
+	mmalsrc->allow_burst = MMALSRC_DEFAULT_ALLOW_BURST;
+	mmalsrc->burst_remaining = 0;
+	mmalsrc->capture_mode = g_strdup(MMALSRC_DEFAULT_CAPTURE_MODE);
+	mmalsrc->capture_cpu = MMALSRC_DEFAULT_THREAD_CPU;
+	mmalsrc->capture_priority = MMALSRC_DEFAULT_THREAD_PRIORITY;
+	mmalsrc->streaming_cpu = MMALSRC_DEFAULT_THREAD_CPU;
+	mmalsrc->streaming_priority = MMALSRC_DEFAULT_THREAD_PRIORITY;
+	mmalsrc->ring_fd = -1;
+	mmalsrc->bayer_bits = MMALSRC_DEFAULT_BAYER_BITS;
+	mmalsrc->bayer_shift = MMALSRC_DEFAULT_BAYER_SHIFT;
+	mmalsrc->bayer_threads = MMALSRC_DEFAULT_BAYER_THREADS;
+	mmalsrc->latency_tracing = g_strdup(MMALSRC_DEFAULT_LATENCY_TRACING);
+	mmalsrc->latency_report = MMALSRC_DEFAULT_LATENCY_REPORT;
+	mmalsrc->pool_adaptive = MMALSRC_DEFAULT_POOL_ADAPTIVE;
+	mmalsrc->pool_min = MMALSRC_DEFAULT_POOL_MIN;
+	mmalsrc->pool_max = MMALSRC_DEFAULT_POOL_MAX;
+	mmalsrc->pool_memory_budget = MMALSRC_DEFAULT_POOL_MEMORY_BUDGET;
+	mmalsrc->watchdog_frames = MMALSRC_DEFAULT_WATCHDOG_FRAMES;
+	mmalsrc->stereo_mode = g_strdup(MMALSRC_DEFAULT_STEREO_MODE);
+	mmalsrc->stereo_tolerance = MMALSRC_DEFAULT_STEREO_TOLERANCE;
+	mmalsrc->batch_size = MMALSRC_DEFAULT_BATCH_SIZE;
+	mmalsrc->batch_latency = MMALSRC_DEFAULT_BATCH_LATENCY;
+	mmalsrc->pyramid_levels = MMALSRC_DEFAULT_PYRAMID_LEVELS;
+	mmalsrc->pyramid_filter = MMALSRC_DEFAULT_PYRAMID_FILTER;
+	mmalsrc->preroll_duration = MMALSRC_DEFAULT_PREROLL_DURATION;
+	mmalsrc->preroll_memory = MMALSRC_DEFAULT_PREROLL_MEMORY;
+	mmalsrc->preroll_subsample = MMALSRC_DEFAULT_PREROLL_SUBSAMPLE;
+	mmalsrc->preroll_hold = MMALSRC_DEFAULT_PREROLL_HOLD;
+	g_mutex_init(&mmalsrc->unpack_lock);
+	g_cond_init(&mmalsrc->unpack_cond);
 	mmalsrc->unlock = false;
 	gst_base_src_set_format(GST_BASE_SRC(mmalsrc), GST_FORMAT_TIME);
 	gst_base_src_set_live(GST_BASE_SRC(mmalsrc), TRUE);
@@ -234,6 +902,14 @@ static void gst_mmalsrc_init(GstMMALSrc *mmalsrc) {
  * Release function
  ******************************************************************/
 void gst_mmalsrc_finalize(GObject * object) {
+	GstMMALSrc *mmalsrc = GST_MMALSRC(object);
+
+	g_free(mmalsrc->capture_mode);
+	g_free(mmalsrc->latency_tracing);
+	g_free(mmalsrc->stereo_mode);
+	g_mutex_clear(&mmalsrc->unpack_lock);
+	g_cond_clear(&mmalsrc->unpack_cond);
+
 	/* Default finalize function */
 	G_OBJECT_CLASS (gst_mmalsrc_parent_class)->finalize(object);
 }
@@ -272,6 +948,189 @@ void gst_mmalsrc_set_property(GObject * object, guint property_id,
 		GST_INFO("exposure set to %s\n", mmalsrc->exposure);
 		break;
 	}
+	case PROP_MOTION_GATE: {
+		mmalsrc->motion_gate = g_value_get_enum(value);
+		GST_INFO("motion gate set to %d\n", mmalsrc->motion_gate);
+		break;
+	}
+	case PROP_MOTION_THRESHOLD: {
+		mmalsrc->motion_threshold = g_value_get_uint(value);
+		GST_INFO("motion threshold set to %d\n", mmalsrc->motion_threshold);
+		break;
+	}
+	case PROP_MOTION_HEARTBEAT: {
+		mmalsrc->motion_heartbeat = g_value_get_uint(value);
+		GST_INFO("motion heartbeat set to %d\n", mmalsrc->motion_heartbeat);
+		break;
+	}
+	case PROP_MOTION_HYSTERESIS: {
+		mmalsrc->motion_hysteresis = g_value_get_uint(value);
+		GST_INFO("motion hysteresis set to %d\n", mmalsrc->motion_hysteresis);
+		break;
+	}
+	case PROP_OUTPUT_RATE: {
+		// Negotiated in the caps : only before streaming
+		if (mmalsrc->camera_component) {
+			GST_WARNING("output rate can only be changed in NULL or READY");
+			break;
+		}
+		mmalsrc->output_rate_num = gst_value_get_fraction_numerator(value);
+		mmalsrc->output_rate_den = gst_value_get_fraction_denominator(value);
+		GST_INFO("output rate set to %d/%d\n", mmalsrc->output_rate_num,
+				mmalsrc->output_rate_den);
+		break;
+	}
+	case PROP_SENSOR_RATE: {
+		if (mmalsrc->camera_component) {
+			GST_WARNING("sensor rate can only be changed in NULL or READY");
+			break;
+		}
+		mmalsrc->sensor_rate_num = gst_value_get_fraction_numerator(value);
+		mmalsrc->sensor_rate_den = gst_value_get_fraction_denominator(value);
+		GST_INFO("sensor rate set to %d/%d\n", mmalsrc->sensor_rate_num,
+				mmalsrc->sensor_rate_den);
+		break;
+	}
+	case PROP_ALLOW_BURST: {
+		mmalsrc->allow_burst = g_value_get_boolean(value);
+		GST_INFO("allow burst set to %d\n", mmalsrc->allow_burst);
+		break;
+	}
+	case PROP_CAPTURE_MODE: {
+		const gchar* capture_mode = g_value_get_string(value);
+		g_free(mmalsrc->capture_mode);
+		mmalsrc->capture_mode = g_strdup(capture_mode);
+		GST_INFO("capture mode set to %s\n", mmalsrc->capture_mode);
+		break;
+	}
+	case PROP_CAPTURE_CPU: {
+		mmalsrc->capture_cpu = g_value_get_int(value);
+		GST_INFO("capture cpu set to %d\n", mmalsrc->capture_cpu);
+		break;
+	}
+	case PROP_CAPTURE_PRIORITY: {
+		mmalsrc->capture_priority = g_value_get_uint(value);
+		GST_INFO("capture priority set to %d\n", mmalsrc->capture_priority);
+		break;
+	}
+	case PROP_STREAMING_CPU: {
+		mmalsrc->streaming_cpu = g_value_get_int(value);
+		GST_INFO("streaming cpu set to %d\n", mmalsrc->streaming_cpu);
+		break;
+	}
+	case PROP_STREAMING_PRIORITY: {
+		mmalsrc->streaming_priority = g_value_get_uint(value);
+		GST_INFO("streaming priority set to %d\n", mmalsrc->streaming_priority);
+		break;
+	}
+	case PROP_BAYER_BITS: {
+		mmalsrc->bayer_bits = g_value_get_uint(value) < 12 ? 10 : 12;
+		GST_INFO("bayer bits set to %d\n", mmalsrc->bayer_bits);
+		break;
+	}
+	case PROP_BAYER_SHIFT: {
+		mmalsrc->bayer_shift = g_value_get_int(value);
+		GST_INFO("bayer shift set to %d\n", mmalsrc->bayer_shift);
+		break;
+	}
+	case PROP_BAYER_THREADS: {
+		mmalsrc->bayer_threads = g_value_get_uint(value);
+		GST_INFO("bayer threads set to %d\n", mmalsrc->bayer_threads);
+		break;
+	}
+	case PROP_LATENCY_TRACING: {
+		const gchar* latency_tracing = g_value_get_string(value);
+		g_free(mmalsrc->latency_tracing);
+		mmalsrc->latency_tracing = g_strdup(latency_tracing);
+		GST_INFO("latency tracing set to %s\n", mmalsrc->latency_tracing);
+		break;
+	}
+	case PROP_LATENCY_REPORT: {
+		mmalsrc->latency_report = g_value_get_uint(value);
+		GST_INFO("latency report set to %d\n", mmalsrc->latency_report);
+		break;
+	}
+	case PROP_POOL_ADAPTIVE: {
+		mmalsrc->pool_adaptive = g_value_get_boolean(value);
+		GST_INFO("pool adaptive set to %d\n", mmalsrc->pool_adaptive);
+		break;
+	}
+	case PROP_POOL_MIN: {
+		mmalsrc->pool_min = g_value_get_uint(value);
+		GST_INFO("pool min set to %d\n", mmalsrc->pool_min);
+		break;
+	}
+	case PROP_POOL_MAX: {
+		mmalsrc->pool_max = g_value_get_uint(value);
+		GST_INFO("pool max set to %d\n", mmalsrc->pool_max);
+		break;
+	}
+	case PROP_POOL_MEMORY_BUDGET: {
+		mmalsrc->pool_memory_budget = g_value_get_uint64(value);
+		GST_INFO("pool memory budget set to %" G_GUINT64_FORMAT "\n",
+				mmalsrc->pool_memory_budget);
+		break;
+	}
+	case PROP_WATCHDOG_FRAMES: {
+		mmalsrc->watchdog_frames = g_value_get_uint(value);
+		GST_INFO("watchdog frames set to %d\n", mmalsrc->watchdog_frames);
+		break;
+	}
+	case PROP_STEREO_MODE: {
+		const gchar* stereo_mode = g_value_get_string(value);
+		g_free(mmalsrc->stereo_mode);
+		mmalsrc->stereo_mode = g_strdup(stereo_mode);
+		GST_INFO("stereo mode set to %s\n", mmalsrc->stereo_mode);
+		break;
+	}
+	case PROP_STEREO_TOLERANCE: {
+		mmalsrc->stereo_tolerance = g_value_get_uint(value);
+		GST_INFO("stereo tolerance set to %d\n", mmalsrc->stereo_tolerance);
+		break;
+	}
+	case PROP_BATCH_SIZE: {
+		mmalsrc->batch_size = g_value_get_uint(value);
+		GST_INFO("batch size set to %d\n", mmalsrc->batch_size);
+		break;
+	}
+	case PROP_BATCH_LATENCY: {
+		mmalsrc->batch_latency = g_value_get_uint(value);
+		GST_INFO("batch latency set to %d\n", mmalsrc->batch_latency);
+		break;
+	}
+	case PROP_PYRAMID_LEVELS: {
+		mmalsrc->pyramid_levels = g_value_get_uint(value);
+		GST_INFO("pyramid levels set to %d\n", mmalsrc->pyramid_levels);
+		break;
+	}
+	case PROP_PYRAMID_FILTER: {
+		mmalsrc->pyramid_filter = g_value_get_enum(value);
+		GST_INFO("pyramid filter set to %d\n", mmalsrc->pyramid_filter);
+		break;
+	}
+	case PROP_PREROLL_DURATION: {
+		mmalsrc->preroll_duration = g_value_get_uint(value);
+		GST_INFO("preroll duration set to %d\n", mmalsrc->preroll_duration);
+		break;
+	}
+	case PROP_PREROLL_MEMORY: {
+		mmalsrc->preroll_memory = g_value_get_uint64(value);
+		GST_INFO("preroll memory set to %" G_GUINT64_FORMAT "\n",
+				mmalsrc->preroll_memory);
+		break;
+	}
+	case PROP_PREROLL_SUBSAMPLE: {
+		mmalsrc->preroll_subsample = g_value_get_uint(value);
+		GST_INFO("preroll subsample set to %d\n", mmalsrc->preroll_subsample);
+		break;
+	}
+	case PROP_PREROLL_HOLD: {
+		mmalsrc->preroll_hold = g_value_get_boolean(value);
+		/* Also while streaming : arms or releases the hold */
+		g_atomic_int_set(&mmalsrc->preroll_holding, mmalsrc->preroll_hold);
+		GST_INFO("preroll hold set to %d\n", mmalsrc->preroll_hold);
+		break;
+	}
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
 		break;
@@ -298,6 +1157,107 @@ void gst_mmalsrc_get_property(GObject * object, guint property_id,
 	case PROP_EXPOSURE:
 		g_value_set_string(value, mmalsrc->exposure);
 		break;
+	case PROP_MOTION_GATE:
+		g_value_set_enum(value, mmalsrc->motion_gate);
+		break;
+	case PROP_MOTION_THRESHOLD:
+		g_value_set_uint(value, (uint) mmalsrc->motion_threshold);
+		break;
+	case PROP_MOTION_HEARTBEAT:
+		g_value_set_uint(value, (uint) mmalsrc->motion_heartbeat);
+		break;
+	case PROP_MOTION_HYSTERESIS:
+		g_value_set_uint(value, (uint) mmalsrc->motion_hysteresis);
+		break;
+	case PROP_OUTPUT_RATE:
+		gst_value_set_fraction(value, mmalsrc->output_rate_num,
+				mmalsrc->output_rate_den);
+		break;
+	case PROP_SENSOR_RATE:
+		gst_value_set_fraction(value, mmalsrc->sensor_rate_num,
+				mmalsrc->sensor_rate_den);
+		break;
+	case PROP_ALLOW_BURST:
+		g_value_set_boolean(value, mmalsrc->allow_burst);
+		break;
+	case PROP_CAPTURE_MODE:
+		g_value_set_string(value, mmalsrc->capture_mode);
+		break;
+	case PROP_CAPTURE_CPU:
+		g_value_set_int(value, mmalsrc->capture_cpu);
+		break;
+	case PROP_CAPTURE_PRIORITY:
+		g_value_set_uint(value, (uint) mmalsrc->capture_priority);
+		break;
+	case PROP_STREAMING_CPU:
+		g_value_set_int(value, mmalsrc->streaming_cpu);
+		break;
+	case PROP_STREAMING_PRIORITY:
+		g_value_set_uint(value, (uint) mmalsrc->streaming_priority);
+		break;
+	case PROP_BAYER_BITS:
+		g_value_set_uint(value, (uint) mmalsrc->bayer_bits);
+		break;
+	case PROP_BAYER_SHIFT:
+		g_value_set_int(value, mmalsrc->bayer_shift);
+		break;
+	case PROP_BAYER_THREADS:
+		g_value_set_uint(value, (uint) mmalsrc->bayer_threads);
+		break;
+	case PROP_LATENCY_TRACING:
+		g_value_set_string(value, mmalsrc->latency_tracing);
+		break;
+	case PROP_LATENCY_REPORT:
+		g_value_set_uint(value, (uint) mmalsrc->latency_report);
+		break;
+	case PROP_POOL_ADAPTIVE:
+		g_value_set_boolean(value, mmalsrc->pool_adaptive);
+		break;
+	case PROP_POOL_MIN:
+		g_value_set_uint(value, (uint) mmalsrc->pool_min);
+		break;
+	case PROP_POOL_MAX:
+		g_value_set_uint(value, (uint) mmalsrc->pool_max);
+		break;
+	case PROP_POOL_MEMORY_BUDGET:
+		g_value_set_uint64(value, mmalsrc->pool_memory_budget);
+		break;
+	case PROP_POOL_SIZE:
+		g_value_set_uint(value, (uint) mmalsrc->pool_size);
+		break;
+	case PROP_WATCHDOG_FRAMES:
+		g_value_set_uint(value, (uint) mmalsrc->watchdog_frames);
+		break;
+	case PROP_STEREO_MODE:
+		g_value_set_string(value, mmalsrc->stereo_mode);
+		break;
+	case PROP_STEREO_TOLERANCE:
+		g_value_set_uint(value, (uint) mmalsrc->stereo_tolerance);
+		break;
+	case PROP_BATCH_SIZE:
+		g_value_set_uint(value, (uint) mmalsrc->batch_size);
+		break;
+	case PROP_BATCH_LATENCY:
+		g_value_set_uint(value, (uint) mmalsrc->batch_latency);
+		break;
+	case PROP_PYRAMID_LEVELS:
+		g_value_set_uint(value, (uint) mmalsrc->pyramid_levels);
+		break;
+	case PROP_PYRAMID_FILTER:
+		g_value_set_enum(value, mmalsrc->pyramid_filter);
+		break;
+	case PROP_PREROLL_DURATION:
+		g_value_set_uint(value, (uint) mmalsrc->preroll_duration);
+		break;
+	case PROP_PREROLL_MEMORY:
+		g_value_set_uint64(value, mmalsrc->preroll_memory);
+		break;
+	case PROP_PREROLL_SUBSAMPLE:
+		g_value_set_uint(value, (uint) mmalsrc->preroll_subsample);
+		break;
+	case PROP_PREROLL_HOLD:
+		g_value_set_boolean(value, mmalsrc->preroll_hold);
+		break;
 
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
@@ -305,6 +1265,65 @@ void gst_mmalsrc_get_property(GObject * object, guint property_id,
 	}
 }
 
+/******************************************************************
+ * gst_mmalsrc_output_rate
+ *
+ * Return TRUE if frames are decimated from the sensor-rate property,
+ * with the rate of pushed frames in num/den.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_output_rate(GstMMALSrc *mmalsrc, gint *num,
+		gint *den) {
+	if (mmalsrc->output_rate_num <= 0)
+		return FALSE;
+
+	// Never faster than the sensor
+	if (gst_util_fraction_compare(mmalsrc->output_rate_num,
+			mmalsrc->output_rate_den, mmalsrc->sensor_rate_num,
+			mmalsrc->sensor_rate_den) > 0) {
+		*num = mmalsrc->sensor_rate_num;
+		*den = mmalsrc->sensor_rate_den;
+	} else {
+		*num = mmalsrc->output_rate_num;
+		*den = mmalsrc->output_rate_den;
+	}
+	return TRUE;
+}
+
+/******************************************************************
+ * gst_mmalsrc_get_caps
+ *
+ * Template caps, with the output rate as framerate when decimating
+ *
+ ******************************************************************/
+static GstCaps *gst_mmalsrc_get_caps(GstBaseSrc * src, GstCaps * filter) {
+	GstMMALSrc *mmalsrc = GST_MMALSRC(src);
+	GstCaps *caps, *tmp;
+	gint num, den;
+
+	caps = gst_pad_get_pad_template_caps(GST_BASE_SRC_PAD(src));
+
+	if (gst_mmalsrc_output_rate(mmalsrc, &num, &den)) {
+		caps = gst_caps_make_writable(caps);
+		if (mmalsrc->allow_burst)
+			gst_caps_set_simple(caps, "framerate", GST_TYPE_FRACTION, 0, 1,
+					"max-framerate", GST_TYPE_FRACTION, mmalsrc->sensor_rate_num,
+					mmalsrc->sensor_rate_den, NULL);
+		else
+			gst_caps_set_simple(caps, "framerate", GST_TYPE_FRACTION, num, den,
+					NULL);
+	}
+
+	if (filter) {
+		tmp = gst_caps_intersect_full(filter, caps, GST_CAPS_INTERSECT_FIRST);
+		gst_caps_unref(caps);
+		caps = tmp;
+	}
+
+	GST_DEBUG("get_caps returning %" GST_PTR_FORMAT, caps);
+	return caps;
+}
+
 /******************************************************************
  * gst_mmalsrc_fixate
  *
@@ -326,46 +1345,232 @@ static GstCaps *gst_mmalsrc_fixate(GstBaseSrc * src, GstCaps * caps) {
 	gst_structure_fixate_field_nearest_fraction(structure, "framerate",
 			MMALSRC_DEFAULT_FRAMERATE_NUM, MMALSRC_DEFAULT_FRAMERATE_DEN);
 
-	gst_structure_fixate_field_string(structure, "format", MMALSRC_DEFAULT_FORMAT);
+	if (gst_structure_has_name(structure, "video/x-bayer"))
+		gst_structure_fixate_field_string(structure, "format",
+				MMALSRC_DEFAULT_BAYER_FORMAT);
+	else
+		gst_structure_fixate_field_string(structure, "format",
+				MMALSRC_DEFAULT_FORMAT);
 
 	gst_structure_fixate_field_nearest_fraction(structure, "pixel-aspect-ratio",
 			MMALSRC_PAR_NUM, MMALSRC_PAR_DEN);
 
+	/* Firmware stereo views are decimated to keep the frame size */
+	if (mmalsrc->stereo != MMAL_STEREOSCOPIC_MODE_NONE)
+		gst_structure_set(structure, "multiview-mode", G_TYPE_STRING,
+				gst_video_multiview_mode_to_caps_string(
+						mmalsrc->stereo == MMAL_STEREOSCOPIC_MODE_TOP_BOTTOM ?
+								GST_VIDEO_MULTIVIEW_MODE_TOP_BOTTOM :
+								GST_VIDEO_MULTIVIEW_MODE_SIDE_BY_SIDE),
+				"multiview-flags", GST_TYPE_VIDEO_MULTIVIEW_FLAGSET,
+				GST_VIDEO_MULTIVIEW_FLAGS_HALF_ASPECT, GST_FLAG_SET_MASK_EXACT,
+				NULL);
+	else if (mmalsrc->stereo_pair)
+		gst_structure_set(structure, "multiview-mode", G_TYPE_STRING,
+				gst_video_multiview_mode_to_caps_string(
+						GST_VIDEO_MULTIVIEW_MODE_SEPARATED),
+				"views", G_TYPE_INT, 2, NULL);
+
 	GST_INFO("fixate returning %" GST_PTR_FORMAT, caps);
 	return caps;
 }
 
 /******************************************************************
- * gst_mmalsrc_set_caps
+ * gst_mmalsrc_raw_select
  *
- * Notify the subclass of new caps
+ * Raw Bayer frames come from the still port with raw capture enabled,
+ * as in raspistill. Make it the camera port, return FALSE if the
+ * camera doesn't support raw capture.
  *
  ******************************************************************/
-static gboolean gst_mmalsrc_set_caps(GstBaseSrc * src, GstCaps * caps) {
-	gboolean res = TRUE;
+static gboolean gst_mmalsrc_raw_select(GstMMALSrc *mmalsrc) {
+	MMAL_PORT_T *port;
+	MMAL_STATUS_T status;
 
-	GstMMALSrc *mmalsrc = GST_MMALSRC(src);
-	GstStructure *structure;
-	GstVideoInfo info;
+	if (!mmalsrc->camera_component)
+		return FALSE;
 
-	if (!gst_video_info_from_caps(&info, caps))
+	port = mmalsrc->camera_component->output[MMAL_CAMERA_CAPTURE_PORT];
+	status = mmal_port_parameter_set_boolean(port,
+			MMAL_PARAMETER_ENABLE_RAW_CAPTURE, 1);
+	if (status != MMAL_SUCCESS) {
+		GST_ERROR("raw capture not supported on %s : error %d", port->name,
+				status);
 		return FALSE;
+	}
 
-	structure = gst_caps_get_structure(caps, 0);
+	mmalsrc->cam_port = port;
+	return TRUE;
+}
 
-	if (gst_structure_has_name(structure, "video/x-raw")) {
+/******************************************************************
+ * gst_mmalsrc_raw_release
+ *
+ * Disable raw capture on the still port, once video/x-raw caps take
+ * over or the element stops.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_raw_release(GstMMALSrc *mmalsrc) {
+	MMAL_PORT_T *port;
+	MMAL_STATUS_T status;
 
-		mmalsrc->width = info.width;
-		mmalsrc->height = info.height;
-		mmalsrc->framerate.num = info.fps_n;
-		mmalsrc->framerate.den = info.fps_d;
-		mmalsrc->par.num = info.par_n;
-		mmalsrc->par.den = info.par_d;
-		//mmalsrc->pixel_format = info.finfo->name;
+	if (!mmalsrc->camera_component)
+		return;
 
-		// If encoding has 3 letters
-		if (info.finfo->name[3] == '\0') {
-			mmalsrc->encoding = MMAL_FOURCC(info.finfo->name[0],
+	port = mmalsrc->camera_component->output[MMAL_CAMERA_CAPTURE_PORT];
+	status = mmal_port_parameter_set_boolean(port,
+			MMAL_PARAMETER_ENABLE_RAW_CAPTURE, 0);
+	if (status != MMAL_SUCCESS)
+		GST_WARNING("couldn't disable raw capture on %s : error %d",
+				port->name, status);
+}
+
+/******************************************************************
+ * gst_mmalsrc_raw_trigger
+ *
+ * The still port gives one frame per capture request, ask for the
+ * next one.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_raw_trigger(GstMMALSrc *mmalsrc) {
+	MMAL_STATUS_T status;
+
+	status = mmal_port_parameter_set_boolean(mmalsrc->cam_port,
+			MMAL_PARAMETER_CAPTURE, 1);
+	if (status != MMAL_SUCCESS)
+		GST_WARNING("raw capture request failed : error %d", status);
+}
+
+/******************************************************************
+ * gst_mmalsrc_set_bayer_caps
+ *
+ * video/x-bayer formats : <order> and <order>16le are unpacked from
+ * the bayer-bits sensor packing, <order>10p and <order>12p are pushed
+ * as packed by the camera. Raw capture is enabled on the still port
+ * here, so an unsupported camera fails the negotiation.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_set_bayer_caps(GstMMALSrc *mmalsrc,
+		GstStructure *structure) {
+	const gchar *format = gst_structure_get_string(structure, "format");
+	const gchar *suffix;
+	gint width, height, fps_n, fps_d;
+	guint i;
+
+	if (!format || strlen(format) < 4
+			|| !gst_structure_get_int(structure, "width", &width)
+			|| !gst_structure_get_int(structure, "height", &height)
+			|| !gst_structure_get_fraction(structure, "framerate", &fps_n,
+					&fps_d))
+		return FALSE;
+
+	for (i = 0; i < G_N_ELEMENTS(bayer_orders); i++)
+		if (strncmp(format, bayer_orders[i].order, 4) == 0)
+			break;
+	if (i == G_N_ELEMENTS(bayer_orders))
+		return FALSE;
+
+	suffix = format + 4;
+	if (*suffix == '\0') {
+		mmalsrc->raw_bits = mmalsrc->bayer_bits;
+		mmalsrc->raw_out_bits = 8;
+	} else if (strcmp(suffix, "16le") == 0) {
+		mmalsrc->raw_bits = mmalsrc->bayer_bits;
+		mmalsrc->raw_out_bits = 16;
+	} else if (strcmp(suffix, "10p") == 0) {
+		mmalsrc->raw_bits = 10;
+		mmalsrc->raw_out_bits = 0;
+	} else if (strcmp(suffix, "12p") == 0) {
+		mmalsrc->raw_bits = 12;
+		mmalsrc->raw_out_bits = 0;
+	} else {
+		return FALSE;
+	}
+
+	mmalsrc->raw = TRUE;
+	mmalsrc->width = width;
+	mmalsrc->height = height;
+	mmalsrc->framerate.num = fps_n;
+	mmalsrc->framerate.den = fps_d;
+	mmalsrc->par.num = MMALSRC_PAR_NUM;
+	mmalsrc->par.den = MMALSRC_PAR_DEN;
+	mmalsrc->encoding = mmalsrc->raw_bits == 10 ?
+			bayer_orders[i].encoding_10 : bayer_orders[i].encoding_12;
+	mmalsrc->raw_shift = mmalsrc->bayer_shift < 0 ?
+			mmalsrc->raw_bits - 8 : (guint) mmalsrc->bayer_shift;
+
+	/* Packed lines are aligned on 32 bytes by the camera */
+	mmalsrc->raw_stride = VCOS_ALIGN_UP(
+			MMAL_UNPACK_PACKED_SIZE(width, mmalsrc->raw_bits), 32);
+	mmalsrc->raw_out_stride = GST_ROUND_UP_4(width * mmalsrc->raw_out_bits / 8);
+
+	return gst_mmalsrc_raw_select(mmalsrc);
+}
+
+/******************************************************************
+ * gst_mmalsrc_sensor_rate
+ *
+ * When decimating, the caps framerate is the output rate: the camera
+ * runs at the sensor-rate property instead.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_sensor_rate(GstMMALSrc *mmalsrc) {
+	if (mmalsrc->output_rate_num <= 0)
+		return;
+
+	mmalsrc->framerate.num = mmalsrc->sensor_rate_num;
+	mmalsrc->framerate.den = mmalsrc->sensor_rate_den;
+}
+
+/******************************************************************
+ * gst_mmalsrc_set_caps
+ *
+ * Notify the subclass of new caps
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_set_caps(GstBaseSrc * src, GstCaps * caps) {
+	gboolean res = TRUE;
+
+	GstMMALSrc *mmalsrc = GST_MMALSRC(src);
+	GstStructure *structure;
+	GstVideoInfo info;
+
+	structure = gst_caps_get_structure(caps, 0);
+
+	if (gst_structure_has_name(structure, "video/x-bayer")) {
+		res = gst_mmalsrc_set_bayer_caps(mmalsrc, structure);
+		gst_mmalsrc_sensor_rate(mmalsrc);
+		GST_INFO("set_caps returning %" GST_PTR_FORMAT, caps);
+		return res;
+	}
+
+	if (!gst_video_info_from_caps(&info, caps))
+		return FALSE;
+
+	if (gst_structure_has_name(structure, "video/x-raw")) {
+
+		if (mmalsrc->raw)
+			gst_mmalsrc_raw_release(mmalsrc);
+		mmalsrc->raw = FALSE;
+		if (mmalsrc->camera_component)
+			mmalsrc->cam_port =
+					mmalsrc->camera_component->output[MMAL_CAMERA_VIDEO_PORT];
+		mmalsrc->width = info.width;
+		mmalsrc->height = info.height;
+		mmalsrc->framerate.num = info.fps_n;
+		mmalsrc->framerate.den = info.fps_d;
+		mmalsrc->par.num = info.par_n;
+		mmalsrc->par.den = info.par_d;
+		//mmalsrc->pixel_format = info.finfo->name;
+
+		/* Planes of MMAL frames are 32 pixels wide and 16 lines high aligned */
+		gst_video_info_set_format(&mmalsrc->frame_info,
+				GST_VIDEO_INFO_FORMAT(&info), VCOS_ALIGN_UP(info.width, 32),
+				VCOS_ALIGN_UP(info.height, 16));
+
+		// If encoding has 3 letters
+		if (info.finfo->name[3] == '\0') {
+			mmalsrc->encoding = MMAL_FOURCC(info.finfo->name[0],
 					info.finfo->name[1], info.finfo->name[2], ' ');
 		}
 
@@ -377,6 +1582,8 @@ static gboolean gst_mmalsrc_set_caps(GstBaseSrc * src, GstCaps * caps) {
 	}
 	// else : if we add other encoding later
 
+	gst_mmalsrc_sensor_rate(mmalsrc);
+
 	GST_INFO("set_caps returning %" GST_PTR_FORMAT, caps);
 
 	return res;
@@ -396,214 +1603,2646 @@ static gboolean gst_mmalsrc_is_seekable(GstBaseSrc * src) {
 	return FALSE;
 }
 
-/******************************************************************
- ******************************************************************
- * Core functions
- ******************************************************************
- ******************************************************************/
+/******************************************************************
+ * gst_mmalsrc_query
+ *
+ * Answer the latency query : a frame is pushed at least one period
+ * of the pushed rate after its capture started, plus the batch wait,
+ * and the camera pool holds at most pool-max periods of frames.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_query(GstBaseSrc * src, GstQuery * query) {
+	GstMMALSrc *mmalsrc = GST_MMALSRC(src);
+	GstClockTime period, min, max;
+	gint num, den;
+
+	if (GST_QUERY_TYPE(query) != GST_QUERY_LATENCY)
+		return GST_BASE_SRC_CLASS(gst_mmalsrc_parent_class)->query(src, query);
+
+	if (!gst_mmalsrc_output_rate(mmalsrc, &num, &den)) {
+		num = mmalsrc->framerate.num;
+		den = mmalsrc->framerate.den;
+	}
+	// Bayer caps carry no framerate
+	if (num <= 0) {
+		num = mmalsrc->sensor_rate_num;
+		den = mmalsrc->sensor_rate_den;
+	}
+	if (num <= 0)
+		return FALSE;
+
+	period = gst_util_uint64_scale_int(GST_SECOND, den, num);
+	min = period;
+	if (mmalsrc->batching)
+		min += mmalsrc->batch_latency * GST_MSECOND;
+	max = MAX(period * MAX(mmalsrc->pool_limit, MMALSRC_FRMBUF_COUNT), min);
+
+	GST_DEBUG("latency : min %" GST_TIME_FORMAT " max %" GST_TIME_FORMAT,
+			GST_TIME_ARGS(min), GST_TIME_ARGS(max));
+	gst_query_set_latency(query, TRUE, min, max);
+	return TRUE;
+}
+
+/******************************************************************
+ ******************************************************************
+ * Change detection
+ ******************************************************************
+ ******************************************************************/
+
+/*******************************************************************
+ * gst_mmalsrc_motion_setup
+ *
+ * Locate the luma samples in the negotiated layout and allocate
+ * the downsampled grids. Called once the port format is committed.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_motion_setup(GstMMALSrc *mmalsrc) {
+	guint cells = MMALSRC_MOTION_GRID_WIDTH * MMALSRC_MOTION_GRID_HEIGHT;
+	guint aligned_width = VCOS_ALIGN_UP(mmalsrc->width, 32);
+
+	/* Packed raw samples : MSB bytes are a good enough luma estimate */
+	if (mmalsrc->raw) {
+		mmalsrc->luma_step = 1;
+		mmalsrc->luma_offset = 0;
+		mmalsrc->luma_stride = mmalsrc->raw_stride;
+	} else switch (mmalsrc->encoding) {
+	case MMAL_ENCODING_RGBA:
+	case MMAL_ENCODING_BGRA:
+		/* Green channel is a good enough luma estimate */
+		mmalsrc->luma_step = 4;
+		mmalsrc->luma_offset = 1;
+		mmalsrc->luma_stride = aligned_width * 4;
+		break;
+	case MMAL_ENCODING_YVYU:
+		mmalsrc->luma_step = 2;
+		mmalsrc->luma_offset = 0;
+		mmalsrc->luma_stride = aligned_width * 2;
+		break;
+	case MMAL_ENCODING_UYVY:
+		mmalsrc->luma_step = 2;
+		mmalsrc->luma_offset = 1;
+		mmalsrc->luma_stride = aligned_width * 2;
+		break;
+	default:
+		/* I420, YV12 : Y plane first */
+		mmalsrc->luma_step = 1;
+		mmalsrc->luma_offset = 0;
+		mmalsrc->luma_stride = aligned_width;
+		break;
+	}
+
+	g_free(mmalsrc->motion_ref);
+	g_free(mmalsrc->motion_cur);
+	mmalsrc->motion_ref = g_malloc0(cells);
+	mmalsrc->motion_cur = g_malloc0(cells);
+	mmalsrc->motion_ref_valid = FALSE;
+	mmalsrc->motion_active = TRUE;
+	mmalsrc->motion_static_count = 0;
+	mmalsrc->motion_gated_count = 0;
+	mmalsrc->motion_score = 0;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_motion_release
+ *
+ ******************************************************************/
+static void gst_mmalsrc_motion_release(GstMMALSrc *mmalsrc) {
+	g_free(mmalsrc->motion_ref);
+	g_free(mmalsrc->motion_cur);
+	mmalsrc->motion_ref = NULL;
+	mmalsrc->motion_cur = NULL;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_luma_sum
+ *
+ * Sum of count luma samples. The contiguous case is kept apart so
+ * the compiler can vectorize it (NEON on the Pi, -O3 in Release
+ * builds).
+ *
+ ******************************************************************/
+static guint32 gst_mmalsrc_luma_sum(const guint8 *p, guint count, guint step) {
+	guint32 sum = 0;
+	guint i;
+
+	if (step == 1) {
+		for (i = 0; i < count; i++)
+			sum += p[i];
+	} else {
+		for (i = 0; i < count; i++)
+			sum += p[i * step];
+	}
+	return sum;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_motion_score
+ *
+ * Downsample the frame luma to the motion grid (mean of every sample
+ * of a cell) and return the mean absolute difference with the
+ * reference. Return 255 when no comparison is possible.
+ *
+ ******************************************************************/
+static guint gst_mmalsrc_motion_score(GstMMALSrc *mmalsrc,
+		MMAL_BUFFER_HEADER_T *buffer_h) {
+	const guint8 *data = buffer_h->data + buffer_h->offset;
+	guint gw = MMALSRC_MOTION_GRID_WIDTH;
+	guint gh = MMALSRC_MOTION_GRID_HEIGHT;
+	guint32 sums[MMALSRC_MOTION_GRID_WIDTH];
+	guint cx, cy, y, y0, y1;
+	guint32 sad = 0;
+
+	if (mmalsrc->width < gw || mmalsrc->height < gh
+			|| buffer_h->length < mmalsrc->luma_stride * mmalsrc->height)
+		return 255;
+
+	for (cy = 0; cy < gh; cy++) {
+		y0 = cy * mmalsrc->height / gh;
+		y1 = (cy + 1) * mmalsrc->height / gh;
+		memset(sums, 0, sizeof(sums));
+
+		/* Line by line, the frame is read once in memory order */
+		for (y = y0; y < y1; y++) {
+			const guint8 *line = data + y * mmalsrc->luma_stride
+					+ mmalsrc->luma_offset;
+
+			for (cx = 0; cx < gw; cx++) {
+				guint x0 = cx * mmalsrc->width / gw;
+				guint x1 = (cx + 1) * mmalsrc->width / gw;
+
+				sums[cx] += gst_mmalsrc_luma_sum(line + x0 * mmalsrc->luma_step,
+						x1 - x0, mmalsrc->luma_step);
+			}
+		}
+
+		for (cx = 0; cx < gw; cx++) {
+			guint x0 = cx * mmalsrc->width / gw;
+			guint x1 = (cx + 1) * mmalsrc->width / gw;
+
+			mmalsrc->motion_cur[cy * gw + cx] = sums[cx]
+					/ ((x1 - x0) * (y1 - y0));
+		}
+	}
+
+	if (!mmalsrc->motion_ref_valid)
+		return 255;
+
+	for (cx = 0; cx < gw * gh; cx++)
+		sad += abs((int) mmalsrc->motion_cur[cx] - (int) mmalsrc->motion_ref[cx]);
+
+	return sad / (gw * gh);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_motion_post
+ *
+ * Post a "mmalsrc-motion" element message on activity changes.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_motion_post(GstMMALSrc *mmalsrc) {
+	GstStructure *s;
+
+	s = gst_structure_new("mmalsrc-motion",
+			"active", G_TYPE_BOOLEAN, mmalsrc->motion_active,
+			"score", G_TYPE_UINT, mmalsrc->motion_score, NULL);
+	gst_element_post_message(GST_ELEMENT(mmalsrc),
+			gst_message_new_element(GST_OBJECT(mmalsrc), s));
+}
+
+/*******************************************************************
+ * gst_mmalsrc_motion_check
+ *
+ * Run change detection on a frame. Return TRUE if the frame has to
+ * be pushed, FALSE if it is static and may be gated. Heartbeat frames
+ * are pushed even when static.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_motion_check(GstMMALSrc *mmalsrc,
+		MMAL_BUFFER_HEADER_T *buffer_h) {
+	gboolean active = mmalsrc->motion_active;
+	guint8 *tmp;
+
+	mmalsrc->motion_score = gst_mmalsrc_motion_score(mmalsrc, buffer_h);
+
+	if (mmalsrc->motion_score >= mmalsrc->motion_threshold) {
+		mmalsrc->motion_static_count = 0;
+		active = TRUE;
+	} else if (++mmalsrc->motion_static_count > mmalsrc->motion_hysteresis) {
+		active = FALSE;
+	}
+
+	if (active != mmalsrc->motion_active) {
+		mmalsrc->motion_active = active;
+		GST_DEBUG("scene %s, score %d", active ? "moving" : "static",
+				mmalsrc->motion_score);
+		gst_mmalsrc_motion_post(mmalsrc);
+	}
+
+	if (!active) {
+		mmalsrc->motion_gated_count++;
+		if (!mmalsrc->motion_heartbeat
+				|| mmalsrc->motion_gated_count < mmalsrc->motion_heartbeat)
+			return FALSE;
+		GST_DEBUG("heartbeat frame");
+	}
+
+	/* Frame is pushed, it becomes the new reference */
+	tmp = mmalsrc->motion_ref;
+	mmalsrc->motion_ref = mmalsrc->motion_cur;
+	mmalsrc->motion_cur = tmp;
+	mmalsrc->motion_ref_valid = TRUE;
+	mmalsrc->motion_gated_count = 0;
+
+	return TRUE;
+}
+
+/******************************************************************
+ ******************************************************************
+ * Decimation and burst capture
+ ******************************************************************
+ ******************************************************************/
+
+/*******************************************************************
+ * gst_mmalsrc_burst
+ *
+ * "burst" action signal handler, may be called from any thread.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_burst(GstMMALSrc *mmalsrc, guint frames) {
+	if (!mmalsrc->allow_burst) {
+		GST_WARNING("burst ignored, allow-burst is off");
+		return;
+	}
+
+	GST_INFO("burst of %d frames requested", frames);
+	g_atomic_int_set(&mmalsrc->burst_remaining, (gint) MIN(frames, G_MAXINT));
+}
+
+/*******************************************************************
+ * gst_mmalsrc_burst_check
+ *
+ * Return TRUE if the current frame belongs to a burst.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_burst_check(GstMMALSrc *mmalsrc) {
+	gint remaining = g_atomic_int_get(&mmalsrc->burst_remaining);
+
+	while (remaining > 0
+			&& !g_atomic_int_compare_and_exchange(&mmalsrc->burst_remaining,
+					remaining, remaining - 1))
+		remaining = g_atomic_int_get(&mmalsrc->burst_remaining);
+
+	return remaining > 0;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_decimate_check
+ *
+ * Return TRUE if the current sensor frame has to be pushed to reach
+ * the output rate. Pushed frames are evenly spaced: each sensor frame
+ * adds the output rate to an accumulator, and a frame is pushed each
+ * time it reaches the sensor rate.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_decimate_check(GstMMALSrc *mmalsrc) {
+	guint64 step, period;
+
+	if (mmalsrc->output_rate_num <= 0 || mmalsrc->framerate.num <= 0)
+		return TRUE;
+
+	/* out_num / out_den over sensor_num / sensor_den, on a common base */
+	step = (guint64) mmalsrc->output_rate_num * mmalsrc->framerate.den;
+	period = (guint64) mmalsrc->framerate.num * mmalsrc->output_rate_den;
+
+	if (step >= period)
+		return TRUE;
+
+	mmalsrc->decimate_acc += step;
+	if (mmalsrc->decimate_acc < period)
+		return FALSE;
+
+	/* Restart the phase after the first frame */
+	mmalsrc->decimate_acc -= period;
+	if (mmalsrc->decimate_acc >= period)
+		mmalsrc->decimate_acc = 0;
+	return TRUE;
+}
+
+/******************************************************************
+ ******************************************************************
+ * Luma pyramid
+ *
+ * Levels are built from the luma samples located for the change
+ * detection, into buffers of a pool of the element, and pushed in a
+ * GstMMALSrcPyramidMeta of the frame.
+ ******************************************************************
+ ******************************************************************/
+
+/*******************************************************************
+ * gst_mmalsrc_pyramid_release
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pyramid_release(GstMMALSrc *mmalsrc) {
+	if (!mmalsrc->pyramid_pool)
+		return;
+
+	/* Level buffers still downstream are freed when they come back */
+	gst_buffer_pool_set_active(mmalsrc->pyramid_pool, FALSE);
+	gst_object_unref(mmalsrc->pyramid_pool);
+	mmalsrc->pyramid_pool = NULL;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pyramid_setup
+ *
+ * Lay the levels out in one buffer and create its pool. Called once
+ * the luma samples are located.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pyramid_setup(GstMMALSrc *mmalsrc) {
+	GstStructure *config;
+	gsize size = 0;
+	guint l;
+
+	gst_mmalsrc_pyramid_release(mmalsrc);
+
+	if (!mmalsrc->pyramid_levels)
+		return;
+
+	if (mmalsrc->raw) {
+		GST_WARNING("no pyramid for raw Bayer frames");
+		return;
+	}
+
+	for (l = 0; l < mmalsrc->pyramid_levels; l++) {
+		mmalsrc->pyramid_width[l] = mmalsrc->width >> (l + 1);
+		mmalsrc->pyramid_height[l] = mmalsrc->height >> (l + 1);
+		mmalsrc->pyramid_stride[l] = VCOS_ALIGN_UP(mmalsrc->pyramid_width[l],
+				16);
+		mmalsrc->pyramid_offset[l] = size;
+		size += (gsize) mmalsrc->pyramid_stride[l] * mmalsrc->pyramid_height[l];
+	}
+
+	mmalsrc->pyramid_pool = gst_buffer_pool_new();
+	config = gst_buffer_pool_get_config(mmalsrc->pyramid_pool);
+	gst_buffer_pool_config_set_params(config, NULL, size, 0, 0);
+
+	if (!gst_buffer_pool_set_config(mmalsrc->pyramid_pool, config)
+			|| !gst_buffer_pool_set_active(mmalsrc->pyramid_pool, TRUE)) {
+		GST_ERROR("couldn't create the pyramid pool");
+		gst_object_unref(mmalsrc->pyramid_pool);
+		mmalsrc->pyramid_pool = NULL;
+		return;
+	}
+
+	GST_INFO("%d pyramid levels in %d bytes", mmalsrc->pyramid_levels,
+			(guint) size);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pyramid_attach
+ *
+ * Build the levels of a frame and attach them to its buffer.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pyramid_attach(GstMMALSrc *mmalsrc, GstBuffer *buf,
+		MMAL_BUFFER_HEADER_T *buffer_h) {
+	uint8_t *dst[MMAL_PYRAMID_MAX_LEVELS];
+	GstMMALSrcPyramidMeta *meta;
+	GstBuffer *levels = NULL;
+	GstMapInfo map;
+	guint l;
+
+	if (buffer_h->length < mmalsrc->luma_stride * mmalsrc->height)
+		return;
+
+	if (gst_buffer_pool_acquire_buffer(mmalsrc->pyramid_pool, &levels, NULL)
+			!= GST_FLOW_OK)
+		return;
+
+	if (!gst_buffer_map(levels, &map, GST_MAP_WRITE)) {
+		gst_buffer_unref(levels);
+		return;
+	}
+
+	for (l = 0; l < mmalsrc->pyramid_levels; l++)
+		dst[l] = map.data + mmalsrc->pyramid_offset[l];
+
+	gst_mmal_pyramid_build(
+			buffer_h->data + buffer_h->offset + mmalsrc->luma_offset,
+			mmalsrc->luma_stride, mmalsrc->luma_step, mmalsrc->width,
+			mmalsrc->height, dst, mmalsrc->pyramid_stride,
+			mmalsrc->pyramid_levels, mmalsrc->pyramid_filter);
+
+	gst_buffer_unmap(levels, &map);
+
+	meta = gst_buffer_add_mmalsrc_pyramid_meta(buf, levels);
+	if (!meta)
+		return;
+
+	meta->n_levels = mmalsrc->pyramid_levels;
+	for (l = 0; l < mmalsrc->pyramid_levels; l++) {
+		meta->width[l] = mmalsrc->pyramid_width[l];
+		meta->height[l] = mmalsrc->pyramid_height[l];
+		meta->stride[l] = mmalsrc->pyramid_stride[l];
+		meta->offset[l] = mmalsrc->pyramid_offset[l];
+	}
+}
+
+/******************************************************************
+ ******************************************************************
+ * Pre-event ring
+ *
+ * Every frame dequeued, pushed or not, is copied in a preallocated
+ * arena, so that the MMAL headers go back to the camera as usual.
+ * flush-preroll gives the copies, oldest first, one per create call
+ * ahead of the next live frame. The segments around them are pushed
+ * by a src pad probe, outside of create : the flush gets one of its
+ * own, ending where the stream had got, and the next live frame
+ * restores the stream segment.
+ ******************************************************************
+ ******************************************************************/
+
+/*******************************************************************
+ * gst_mmalsrc_flush_preroll
+ *
+ * "flush-preroll" action signal handler, may be called from any thread.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_flush_preroll(GstMMALSrc *mmalsrc) {
+	GST_INFO("pre-event ring flush requested");
+	g_atomic_int_set(&mmalsrc->preroll_flush, 1);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_preroll_release
+ *
+ ******************************************************************/
+static void gst_mmalsrc_preroll_release(GstMMALSrc *mmalsrc) {
+	g_free(mmalsrc->preroll_arena);
+	g_free(mmalsrc->preroll_slots);
+	mmalsrc->preroll_arena = NULL;
+	mmalsrc->preroll_slots = NULL;
+	mmalsrc->preroll_count = 0;
+	mmalsrc->preroll_fill = 0;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_preroll_setup
+ *
+ * Allocate the arena for preroll-duration of frames within
+ * preroll-memory. Called once the port format is committed. A camera
+ * restart keeps the frames of an arena of the same size.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_preroll_setup(GstMMALSrc *mmalsrc) {
+	MMAL_RATIONAL_T rate = mmalsrc->framerate;
+	gsize slot_size;
+	guint64 frames;
+	guint count;
+
+	if (!mmalsrc->preroll_duration)
+		return;
+
+	if (mmalsrc->stereo_pair) {
+		GST_WARNING("no pre-event ring for stereo pairs");
+		return;
+	}
+
+	slot_size = mmalsrc->raw && mmalsrc->raw_out_bits ?
+			(gsize) mmalsrc->raw_out_stride * mmalsrc->height :
+			mmalsrc->cam_port->buffer_size;
+
+	if (rate.num <= 0 || rate.den <= 0) {
+		rate.num = MMALSRC_DEFAULT_FRAMERATE_NUM;
+		rate.den = MMALSRC_DEFAULT_FRAMERATE_DEN;
+	}
+
+	frames = gst_util_uint64_scale_ceil(mmalsrc->preroll_duration, rate.num,
+			(guint64) rate.den * 1000 * mmalsrc->preroll_subsample);
+	count = MIN(MIN(frames, mmalsrc->preroll_memory / slot_size), G_MAXUINT);
+	if (!count) {
+		GST_WARNING("preroll-memory too small for one frame of %d bytes",
+				(guint) slot_size);
+		gst_mmalsrc_preroll_release(mmalsrc);
+		return;
+	}
+
+	if (mmalsrc->preroll_arena && mmalsrc->preroll_count == count
+			&& mmalsrc->preroll_slot_size == slot_size)
+		return;
+
+	gst_mmalsrc_preroll_release(mmalsrc);
+
+	mmalsrc->preroll_arena = g_try_malloc((gsize) count * slot_size);
+	if (!mmalsrc->preroll_arena) {
+		GST_ERROR("couldn't allocate the pre-event ring");
+		return;
+	}
+	/* Fault the pages in now rather than in the streaming thread */
+	memset(mmalsrc->preroll_arena, 0, (gsize) count * slot_size);
+
+	mmalsrc->preroll_slots = g_new0(GstMMALSrcPrerollSlot, count);
+	mmalsrc->preroll_count = count;
+	mmalsrc->preroll_slot_size = slot_size;
+	mmalsrc->preroll_head = 0;
+	mmalsrc->preroll_skip = 0;
+
+	GST_INFO("pre-event ring of %d frames of %d bytes", count,
+			(guint) slot_size);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_preroll_store
+ *
+ * Copy a buffer in the next slot, overwriting the oldest frame.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_preroll_store(GstMMALSrc *mmalsrc, GstBuffer *buf) {
+	GstMMALSrcPrerollSlot *slot;
+	gsize size = gst_buffer_get_size(buf);
+
+	if (size > mmalsrc->preroll_slot_size)
+		return;
+
+	slot = &mmalsrc->preroll_slots[mmalsrc->preroll_head];
+	slot->size = gst_buffer_extract(buf, 0, mmalsrc->preroll_arena
+			+ (gsize) mmalsrc->preroll_head * mmalsrc->preroll_slot_size, size);
+	slot->pts = GST_BUFFER_PTS(buf);
+	slot->duration = GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DURATION(buf)) ?
+			GST_BUFFER_DURATION(buf) * mmalsrc->preroll_subsample :
+			GST_CLOCK_TIME_NONE;
+
+	mmalsrc->preroll_head = (mmalsrc->preroll_head + 1)
+			% mmalsrc->preroll_count;
+	if (mmalsrc->preroll_fill < mmalsrc->preroll_count)
+		mmalsrc->preroll_fill++;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_preroll_take
+ *
+ * If a flush was requested, empty the ring into a new list, oldest
+ * frame first, skipping frames older than preroll-duration before the
+ * newest one. Return NULL otherwise.
+ *
+ ******************************************************************/
+static GstBufferList *gst_mmalsrc_preroll_take(GstMMALSrc *mmalsrc) {
+	GstClockTime span = mmalsrc->preroll_duration * GST_MSECOND;
+	GstClockTime newest;
+	GstMMALSrcPrerollSlot *slot;
+	GstBufferList *list;
+	GstBuffer *buf;
+	guint i, idx;
+
+	if (!g_atomic_int_compare_and_exchange(&mmalsrc->preroll_flush, 1, 0))
+		return NULL;
+
+	if (g_atomic_int_compare_and_exchange(&mmalsrc->preroll_holding, TRUE,
+			FALSE))
+		GST_INFO("pre-event hold released");
+	if (!mmalsrc->preroll_fill)
+		return NULL;
+
+	list = gst_buffer_list_new_sized(mmalsrc->preroll_fill
+			+ mmalsrc->batch_size);
+	newest = mmalsrc->preroll_slots[(mmalsrc->preroll_head
+			+ mmalsrc->preroll_count - 1) % mmalsrc->preroll_count].pts;
+
+	for (i = 0; i < mmalsrc->preroll_fill; i++) {
+		idx = (mmalsrc->preroll_head + mmalsrc->preroll_count
+				- mmalsrc->preroll_fill + i) % mmalsrc->preroll_count;
+		slot = &mmalsrc->preroll_slots[idx];
+
+		if (GST_CLOCK_TIME_IS_VALID(slot->pts)
+				&& GST_CLOCK_TIME_IS_VALID(newest) && slot->pts + span < newest)
+			continue;
+
+		buf = gst_buffer_new_allocate(NULL, slot->size, NULL);
+		if (!buf)
+			continue;
+
+		gst_buffer_fill(buf, 0, mmalsrc->preroll_arena
+				+ (gsize) idx * mmalsrc->preroll_slot_size, slot->size);
+		GST_BUFFER_PTS(buf) = slot->pts;
+		GST_BUFFER_DURATION(buf) = slot->duration;
+
+		// Timestamps go back in time, a new segment is pushed first
+		if (!gst_buffer_list_length(list)) {
+			GST_BUFFER_FLAG_SET(buf, GST_BUFFER_FLAG_DISCONT);
+			gst_mini_object_set_qdata(GST_MINI_OBJECT(buf), preroll_quark,
+					GINT_TO_POINTER(MMALSRC_PREROLL_FLUSH), NULL);
+		}
+
+		gst_buffer_list_add(list, buf);
+	}
+
+	GST_INFO("flushing %d pre-event frames", gst_buffer_list_length(list));
+	mmalsrc->preroll_fill = 0;
+
+	return list;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_preroll_next
+ *
+ * Give the next frame of a flush in *buf, taking the ring when a flush
+ * was requested. Once the last one is given, the next live frame
+ * restores the stream segment. Return FALSE when there is none.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_preroll_next(GstMMALSrc *mmalsrc,
+		GstBuffer **buf) {
+	GstBufferList *pending;
+
+	// A new flush waits for the stream segment of the last one
+	if (!mmalsrc->preroll_pending && !mmalsrc->preroll_resume) {
+		mmalsrc->preroll_pending = gst_mmalsrc_preroll_take(mmalsrc);
+		mmalsrc->preroll_sent = 0;
+	}
+	pending = mmalsrc->preroll_pending;
+	if (!pending)
+		return FALSE;
+
+	*buf = gst_buffer_ref(gst_buffer_list_get(pending, mmalsrc->preroll_sent));
+	if (++mmalsrc->preroll_sent == gst_buffer_list_length(pending)) {
+		gst_buffer_list_unref(pending);
+		mmalsrc->preroll_pending = NULL;
+		mmalsrc->preroll_resume = TRUE;
+	}
+	return TRUE;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_preroll_hold
+ *
+ * With preroll-hold, TRUE while live frames go to the ring only, until
+ * a flush or the property is cleared.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_preroll_hold(GstMMALSrc *mmalsrc) {
+	return mmalsrc->preroll_arena
+			&& g_atomic_int_get(&mmalsrc->preroll_holding);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_preroll_segment
+ *
+ * Push the segment marked on buf, from the streaming thread once the
+ * base class has pushed its own. The segment of a flush starting at
+ * the oldest frame, buf, starts where the stream had got in running
+ * time when that frame is older, and the stream segment is saved for
+ * the first live frame after the flush.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_preroll_segment(GstMMALSrc *mmalsrc, GstPad *pad,
+		GstBuffer *buf) {
+	GstClockTime first = GST_BUFFER_PTS(buf);
+	GstClockTime end = mmalsrc->pushed_end;
+	GstEvent *event;
+	GstSegment segment;
+	guint64 running;
+
+	switch (GPOINTER_TO_INT(gst_mini_object_get_qdata(GST_MINI_OBJECT(buf),
+			preroll_quark))) {
+	case MMALSRC_PREROLL_FLUSH:
+		event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+		if (!event)
+			return;
+		gst_event_copy_segment(event, &mmalsrc->preroll_stream);
+		gst_event_unref(event);
+
+		gst_segment_copy_into(&mmalsrc->preroll_stream, &segment);
+		if (GST_CLOCK_TIME_IS_VALID(end) && GST_CLOCK_TIME_IS_VALID(first)
+				&& first < end) {
+			running = gst_segment_to_running_time(&segment, GST_FORMAT_TIME,
+					end);
+			if (GST_CLOCK_TIME_IS_VALID(running)) {
+				segment.base = running;
+				segment.start = first;
+				segment.time = first;
+				segment.position = first;
+			}
+		}
+		GST_INFO("pre-event segment %" GST_SEGMENT_FORMAT, &segment);
+		break;
+	case MMALSRC_PREROLL_RESUME:
+		gst_segment_copy_into(&mmalsrc->preroll_stream, &segment);
+		GST_INFO("stream segment restored");
+		break;
+	default:
+		return;
+	}
+
+	if (!gst_pad_push_event(pad, gst_event_new_segment(&segment)))
+		GST_WARNING("pre-event segment not pushed");
+}
+
+/*******************************************************************
+ * gst_mmalsrc_preroll_probe
+ *
+ * Pushes the pre-event segments ahead of the buffers they mark, or of
+ * the list the first of them is in.
+ *
+ ******************************************************************/
+static GstPadProbeReturn gst_mmalsrc_preroll_probe(GstPad *pad,
+		GstPadProbeInfo *info, gpointer user_data) {
+	GstMMALSrc *mmalsrc = GST_MMALSRC(user_data);
+	GstBufferList *list;
+
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER)
+		gst_mmalsrc_preroll_segment(mmalsrc, pad,
+				GST_PAD_PROBE_INFO_BUFFER(info));
+
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+		list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+		if (gst_buffer_list_length(list))
+			gst_mmalsrc_preroll_segment(mmalsrc, pad,
+					gst_buffer_list_get(list, 0));
+	}
+
+	return GST_PAD_PROBE_OK;
+}
+
+/******************************************************************
+ ******************************************************************
+ * Latency tracing
+ ******************************************************************
+ ******************************************************************/
+
+static const gchar *latency_stage_names[MMALSRC_LATENCY_STAGES] = {
+	"sensor-to-callback",
+	"callback-to-dequeue",
+	"dequeue-to-push",
+	"sensor-to-push"
+};
+
+/*******************************************************************
+ * gst_mmalsrc_latency_reset
+ *
+ ******************************************************************/
+static void gst_mmalsrc_latency_reset(GstMMALSrc *mmalsrc) {
+	memset(mmalsrc->latency_stages, 0, sizeof(mmalsrc->latency_stages));
+	mmalsrc->latency_frames = 0;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_latency_add
+ *
+ * Account the latency between two stage timestamps, ignored if one
+ * of them is unknown.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_latency_add(GstMMALSrcLatencyStage *stage,
+		gint64 from, gint64 to) {
+	gint64 us;
+	guint b = 0;
+
+	if (!from || !to)
+		return;
+
+	us = MAX(to - from, 0);
+	while (b < MMALSRC_LATENCY_BUCKETS - 1 && ((gint64) 1 << b) <= us)
+		b++;
+
+	stage->buckets[b]++;
+	stage->sum += us;
+	if (!stage->count || us < stage->min)
+		stage->min = us;
+	if (us > stage->max)
+		stage->max = us;
+	stage->count++;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_latency_percentile
+ *
+ * Upper bound of the histogram bucket holding the given percentile.
+ *
+ ******************************************************************/
+static guint64 gst_mmalsrc_latency_percentile(GstMMALSrcLatencyStage *stage,
+		guint percent) {
+	guint64 target = ((guint64) stage->count * percent + 99) / 100;
+	guint64 seen = 0;
+	guint b;
+
+	for (b = 0; b < MMALSRC_LATENCY_BUCKETS; b++) {
+		seen += stage->buckets[b];
+		if (seen >= target)
+			break;
+	}
+	return MIN((guint64) 1 << MIN(b, MMALSRC_LATENCY_BUCKETS - 1),
+			(guint64) stage->max);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_latency_post
+ *
+ * Post a "mmalsrc-latency" element message with, for each stage,
+ * <stage>-min, -mean, -p50, -p99 and -max in microseconds.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_latency_post(GstMMALSrc *mmalsrc) {
+	GstStructure *s = gst_structure_new("mmalsrc-latency",
+			"frames", G_TYPE_UINT, mmalsrc->latency_frames, NULL);
+	guint i;
+
+	for (i = 0; i < MMALSRC_LATENCY_STAGES; i++) {
+		GstMMALSrcLatencyStage *stage = &mmalsrc->latency_stages[i];
+		gchar *min, *mean, *p50, *p99, *max;
+
+		if (!stage->count)
+			continue;
+
+		min = g_strdup_printf("%s-min", latency_stage_names[i]);
+		mean = g_strdup_printf("%s-mean", latency_stage_names[i]);
+		p50 = g_strdup_printf("%s-p50", latency_stage_names[i]);
+		p99 = g_strdup_printf("%s-p99", latency_stage_names[i]);
+		max = g_strdup_printf("%s-max", latency_stage_names[i]);
+
+		gst_structure_set(s,
+				min, G_TYPE_UINT64, (guint64) stage->min,
+				mean, G_TYPE_UINT64, (guint64) (stage->sum / stage->count),
+				p50, G_TYPE_UINT64, gst_mmalsrc_latency_percentile(stage, 50),
+				p99, G_TYPE_UINT64, gst_mmalsrc_latency_percentile(stage, 99),
+				max, G_TYPE_UINT64, (guint64) stage->max, NULL);
+
+		g_free(min);
+		g_free(mean);
+		g_free(p50);
+		g_free(p99);
+		g_free(max);
+	}
+
+	gst_element_post_message(GST_ELEMENT(mmalsrc),
+			gst_message_new_element(GST_OBJECT(mmalsrc), s));
+}
+
+/*******************************************************************
+ * gst_mmalsrc_latency_record
+ *
+ * Close the timestamps of a pushed buffer and account them.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_latency_record(GstMMALSrc *mmalsrc, GstBuffer *buf) {
+	GstMMALSrcLatencyMeta *meta = gst_buffer_get_mmalsrc_latency_meta(buf);
+	GstMMALSrcLatencyStage *stages = mmalsrc->latency_stages;
+
+	if (!meta)
+		return;
+
+	meta->push = g_get_monotonic_time();
+
+	gst_mmalsrc_latency_add(&stages[MMALSRC_LATENCY_SENSOR_TO_CALLBACK],
+			meta->sensor, meta->callback);
+	gst_mmalsrc_latency_add(&stages[MMALSRC_LATENCY_CALLBACK_TO_DEQUEUE],
+			meta->callback, meta->dequeue);
+	gst_mmalsrc_latency_add(&stages[MMALSRC_LATENCY_DEQUEUE_TO_PUSH],
+			meta->dequeue, meta->push);
+	gst_mmalsrc_latency_add(&stages[MMALSRC_LATENCY_SENSOR_TO_PUSH],
+			meta->sensor, meta->push);
+
+	if (mmalsrc->latency_report
+			&& ++mmalsrc->latency_frames >= mmalsrc->latency_report) {
+		gst_mmalsrc_latency_post(mmalsrc);
+		gst_mmalsrc_latency_reset(mmalsrc);
+	}
+}
+
+/*******************************************************************
+ * gst_mmalsrc_latency_probe
+ *
+ * Src pad probe, called when a buffer or a list leaves the element.
+ *
+ ******************************************************************/
+static GstPadProbeReturn gst_mmalsrc_latency_probe(GstPad *pad,
+		GstPadProbeInfo *info, gpointer user_data) {
+	GstMMALSrc *mmalsrc = GST_MMALSRC(user_data);
+	GstBufferList *list;
+	guint i;
+
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER)
+		gst_mmalsrc_latency_record(mmalsrc, GST_PAD_PROBE_INFO_BUFFER(info));
+
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+		list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+		for (i = 0; i < gst_buffer_list_length(list); i++)
+			gst_mmalsrc_latency_record(mmalsrc, gst_buffer_list_get(list, i));
+	}
+
+	return GST_PAD_PROBE_OK;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_latency_setup
+ *
+ * Map the VideoCore STC (frame pts) on the monotonic clock.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_latency_setup(GstMMALSrc *mmalsrc) {
+	uint64_t stc;
+
+	mmalsrc->stc_valid = mmal_port_parameter_get_uint64(mmalsrc->cam_port,
+			MMAL_PARAMETER_SYSTEM_TIME, &stc) == MMAL_SUCCESS;
+	if (mmalsrc->stc_valid)
+		mmalsrc->stc_offset = g_get_monotonic_time() - (gint64) stc;
+	else
+		GST_WARNING("no VideoCore system time, sensor stage not traced");
+
+	gst_mmalsrc_latency_reset(mmalsrc);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_latency_stamp
+ *
+ * Attach the latency meta to a buffer. dequeue is the time the frame
+ * left the queue, pts and callback come from its MMAL header.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_latency_stamp(GstMMALSrc *mmalsrc, GstBuffer *buf,
+		gint64 pts, gint64 callback, gint64 dequeue) {
+	GstMMALSrcLatencyMeta *meta = gst_buffer_add_mmalsrc_latency_meta(buf);
+
+	if (!meta)
+		return;
+
+	if (mmalsrc->stc_valid && pts != MMAL_TIME_UNKNOWN)
+		meta->sensor = pts + mmalsrc->stc_offset;
+	meta->callback = callback;
+	meta->dequeue = dequeue;
+}
+
+/******************************************************************
+ ******************************************************************
+ * Elastic pool
+ *
+ * Without pool-adaptive, cam_pool holds MMALSRC_FRMBUF_COUNT headers
+ * for the whole stream.
+ * With it, cam_pool holds the pool-min headers. Extra headers, each in
+ * a pool of its own, are given to the camera or retired as the
+ * downstream hold time changes, starting from MMALSRC_FRMBUF_COUNT.
+ * The port is enabled for some headers more than it is given : up to
+ * that number, headers are given or retired while it runs. Beyond, it
+ * is disabled and enabled again with more room, the frames it already
+ * filled stay queued for create. A retired header is destroyed once back
+ * home, so are the pools of a torn down port. A retired pool holds a
+ * reference on its camera component, the payloads are freed through
+ * the port that allocated them. Once the element stops, the retired
+ * pools still held downstream are let go: the last header released
+ * destroys its pool.
+ ******************************************************************
+ ******************************************************************/
+
+/*******************************************************************
+ * gst_mmalsrc_pool_attach
+ *
+ * Point the user_data of the pool headers to their info.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pool_attach(GstMMALSrc *mmalsrc, MMAL_POOL_T *pool,
+		GstMMALSrcHeaderInfo *info) {
+	guint i;
+
+	for (i = 0; i < pool->headers_num; i++) {
+		info[i].mmalsrc = mmalsrc;
+		pool->header[i]->user_data = &info[i];
+	}
+}
+
+struct _GstMMALSrcRetiredPool {
+	MMAL_PORT_T *port;
+	MMAL_POOL_T *pool;
+	GstMMALSrcHeaderInfo *info;
+	gboolean orphan;           /* let go by the element, under retired_lock */
+};
+
+/*******************************************************************
+ * gst_mmalsrc_pool_home
+ *
+ * TRUE when every header of a pool is back in it.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_pool_home(MMAL_POOL_T *pool) {
+	return mmal_queue_length(pool->queue) >= pool->headers_num;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pool_retired_free
+ *
+ * Destroy a retired pool and drop its component reference, last so
+ * that the port outlives the pool.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pool_retired_free(GstMMALSrcRetiredPool *retired) {
+	MMAL_COMPONENT_T *component = retired->port->component;
+
+	mmal_port_pool_destroy(retired->port, retired->pool);
+	mmal_component_release(component);
+	g_free(retired->info);
+	g_free(retired);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pool_collect
+ *
+ * Destroy the retired extra headers that came back, from the top so
+ * that the alive ones stay contiguous, and the retired pools whose
+ * headers all came back.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pool_collect(GstMMALSrc *mmalsrc) {
+	GstMMALSrcExtraHeader *extra;
+	GSList *l, *next;
+
+	g_mutex_lock(&retired_lock);
+	for (l = mmalsrc->retired_pools; l; l = next) {
+		GstMMALSrcRetiredPool *retired = (GstMMALSrcRetiredPool *) l->data;
+
+		next = l->next;
+		if (!gst_mmalsrc_pool_home(retired->pool))
+			continue;
+
+		gst_mmalsrc_pool_retired_free(retired);
+		mmalsrc->retired_pools = g_slist_delete_link(mmalsrc->retired_pools, l);
+	}
+	g_mutex_unlock(&retired_lock);
+
+	while (mmalsrc->extra_allocated > mmalsrc->extra_active) {
+		extra = &mmalsrc->extra[mmalsrc->extra_allocated - 1];
+		if (mmal_queue_length(extra->pool->queue) < extra->pool->headers_num)
+			break;
+
+		mmal_port_pool_destroy(mmalsrc->cam_port, extra->pool);
+		extra->pool = NULL;
+		mmalsrc->extra_allocated--;
+	}
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pool_resize
+ *
+ * Give size headers to the camera, within what can be allocated.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pool_resize(GstMMALSrc *mmalsrc, guint size) {
+	guint base = mmalsrc->cam_pool->headers_num;
+	guint extras = size > base ? size - base : 0;
+	GstMMALSrcExtraHeader *extra;
+
+	while (mmalsrc->extra_active < extras) {
+		extra = &mmalsrc->extra[mmalsrc->extra_active];
+		if (!extra->pool) {
+			extra->pool = mmal_port_pool_create(mmalsrc->cam_port, 1,
+					mmalsrc->cam_port->buffer_size);
+			if (!extra->pool) {
+				GST_WARNING("no memory for more camera buffers");
+				break;
+			}
+			gst_mmalsrc_pool_attach(mmalsrc, extra->pool, &extra->info);
+			mmalsrc->extra_allocated++;
+		}
+		mmalsrc->extra_active++;
+	}
+
+	if (mmalsrc->extra_active > extras)
+		mmalsrc->extra_active = extras;
+	gst_mmalsrc_pool_collect(mmalsrc);
+
+	size = base + mmalsrc->extra_active;
+	if (size != mmalsrc->pool_size) {
+		GST_INFO("camera pool size : %d -> %d", mmalsrc->pool_size, size);
+		mmalsrc->pool_size = size;
+		g_object_notify(G_OBJECT(mmalsrc), "pool-size");
+	}
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pool_setup
+ *
+ * Size the camera port and create cam_pool. The port buffer size must
+ * be set. Return FALSE on failure.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_pool_setup(GstMMALSrc *mmalsrc) {
+	MMAL_PORT_T *port = mmalsrc->cam_port;
+	guint base, limit;
+
+	if (mmalsrc->pool_adaptive) {
+		base = MAX(mmalsrc->pool_min, port->buffer_num_min);
+		limit = MAX(mmalsrc->pool_max, base);
+		if (limit > base + MMALSRC_MAX_POOL_SIZE)
+			limit = base + MMALSRC_MAX_POOL_SIZE;
+	} else {
+		base = MAX(MMALSRC_FRMBUF_COUNT, port->buffer_num_min);
+		limit = base;
+	}
+
+	if (mmalsrc->pool_adaptive && mmalsrc->pool_memory_budget) {
+		guint64 fit = mmalsrc->pool_memory_budget / port->buffer_size;
+
+		if (fit < base)
+			GST_WARNING("memory budget below %d camera buffers", base);
+		limit = CLAMP(fit, base, limit);
+	}
+	mmalsrc->pool_limit = limit;
+
+	mmalsrc->cam_pool = mmal_port_pool_create(port, base, port->buffer_size);
+	if (!mmalsrc->cam_pool)
+		return FALSE;
+
+	g_free(mmalsrc->pool_info);
+	mmalsrc->pool_info = g_new0(GstMMALSrcHeaderInfo, base);
+	gst_mmalsrc_pool_attach(mmalsrc, mmalsrc->cam_pool, mmalsrc->pool_info);
+
+	mmalsrc->extra_active = 0;
+	mmalsrc->extra_allocated = 0;
+	mmalsrc->pool_size = base;
+	mmalsrc->pool_peak = 0;
+	mmalsrc->pool_dry = 0;
+	mmalsrc->pool_frames = 0;
+	mmalsrc->pool_shrink = 0;
+
+	/* The port is still disabled, extra headers can be created */
+	gst_mmalsrc_pool_resize(mmalsrc, CLAMP(MMALSRC_FRMBUF_COUNT, base, limit));
+	port->buffer_num = mmalsrc->pool_size;
+	return TRUE;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pool_reconfigure
+ *
+ * Give the camera port size headers. When they don't fit in its
+ * buffer_num, disable it and enable it again with MMALSRC_POOL_HEADROOM
+ * headers of room, without flushing the frames already queued: the
+ * headers it gives back empty go home from the callback. Return FALSE
+ * if the port couldn't be enabled again.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_pool_reconfigure(GstMMALSrc *mmalsrc, guint size) {
+	MMAL_PORT_T *port = mmalsrc->cam_port;
+	MMAL_STATUS_T status;
+
+	gst_mmalsrc_pool_resize(mmalsrc, size);
+	if (mmalsrc->pool_size <= port->buffer_num)
+		return TRUE;
+
+	mmal_port_disable(port);
+	port->buffer_num = MIN(mmalsrc->pool_size + MMALSRC_POOL_HEADROOM,
+			mmalsrc->pool_limit);
+	GST_INFO("%s enabled again for %d buffers", port->name, port->buffer_num);
+
+	status = mmal_port_enable(port, generic_output_port_cb);
+	if (status != MMAL_SUCCESS) {
+		GST_ELEMENT_ERROR(mmalsrc, RESOURCE, FAILED,
+				("Couldn't give more buffers to the camera"),
+				("failed to enable %s again : error %d", port->name, status));
+		mmalsrc->port_failed = TRUE;
+		return FALSE;
+	}
+
+	if (mmalsrc->raw)
+		gst_mmalsrc_raw_trigger(mmalsrc);
+	return TRUE;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pool_retire_one
+ *
+ * Keep a pool of a torn down port until its headers come back, and
+ * the component of the port until then. info, if any, is owned by the
+ * retired pool from now on. Without it, the headers get one that
+ * counts nothing, so that their release still finds the pool.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pool_retire_one(GstMMALSrc *mmalsrc, MMAL_PORT_T *port,
+		MMAL_POOL_T *pool, GstMMALSrcHeaderInfo *info) {
+	GstMMALSrcRetiredPool *retired = g_new0(GstMMALSrcRetiredPool, 1);
+	guint i;
+
+	if (!info)
+		info = g_new0(GstMMALSrcHeaderInfo, pool->headers_num);
+
+	g_mutex_lock(&retired_lock);
+	for (i = 0; i < pool->headers_num; i++) {
+		info[i].retired = retired;
+		pool->header[i]->user_data = &info[i];
+	}
+	g_mutex_unlock(&retired_lock);
+
+	mmal_component_acquire(port->component);
+	retired->port = port;
+	retired->pool = pool;
+	retired->info = info;
+	mmalsrc->retired_pools = g_slist_prepend(mmalsrc->retired_pools, retired);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pool_retire
+ *
+ * Retire cam_pool and the extra headers, once the port is disabled.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pool_retire(GstMMALSrc *mmalsrc) {
+	guint i;
+
+	for (i = 0; i < mmalsrc->extra_allocated; i++) {
+		GstMMALSrcHeaderInfo *info = g_new(GstMMALSrcHeaderInfo, 1);
+
+		*info = mmalsrc->extra[i].info;
+		gst_mmalsrc_pool_retire_one(mmalsrc, mmalsrc->cam_port,
+				mmalsrc->extra[i].pool, info);
+		mmalsrc->extra[i].pool = NULL;
+	}
+	mmalsrc->extra_active = 0;
+	mmalsrc->extra_allocated = 0;
+
+	gst_mmalsrc_pool_retire_one(mmalsrc, mmalsrc->cam_port, mmalsrc->cam_pool,
+			mmalsrc->pool_info);
+	mmalsrc->cam_pool = NULL;
+	mmalsrc->pool_info = NULL;
+
+	gst_mmalsrc_pool_collect(mmalsrc);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pool_release
+ *
+ * Once the element stops, destroy the retired pools back home and let
+ * the others go: their headers no longer point to the element, and
+ * the last one released downstream destroys its pool. The components
+ * go away with the last of their pools.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pool_release(GstMMALSrc *mmalsrc) {
+	GstMMALSrcRetiredPool *retired;
+	guint i;
+
+	g_mutex_lock(&retired_lock);
+	while (mmalsrc->retired_pools) {
+		retired = (GstMMALSrcRetiredPool *) mmalsrc->retired_pools->data;
+		mmalsrc->retired_pools = g_slist_delete_link(mmalsrc->retired_pools,
+				mmalsrc->retired_pools);
+
+		if (gst_mmalsrc_pool_home(retired->pool)) {
+			gst_mmalsrc_pool_retired_free(retired);
+			continue;
+		}
+
+		GST_INFO("%s : %d buffers still held downstream", retired->port->name,
+				retired->pool->headers_num
+						- mmal_queue_length(retired->pool->queue));
+		for (i = 0; i < retired->pool->headers_num; i++)
+			retired->info[i].mmalsrc = NULL;
+		retired->orphan = TRUE;
+	}
+	g_mutex_unlock(&retired_lock);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pool_check
+ *
+ * Called for each dequeued frame. Every MMALSRC_POOL_WINDOW frames,
+ * size the pool for the mean downstream hold time and the peak of
+ * held headers. The pool grows at once, and when the camera ran dry,
+ * but only shrinks one header after a few quiet windows. Shrinking
+ * never touches the port, growing only past its buffer_num.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pool_check(GstMMALSrc *mmalsrc) {
+	guint outstanding = MAX(g_atomic_int_get(&mmalsrc->outstanding), 0);
+	guint target, need = 0;
+	gint hold, count;
+
+	gst_mmalsrc_pool_collect(mmalsrc);
+	if (!mmalsrc->pool_adaptive)
+		return;
+
+	/* The port failed to come back, create reports it */
+	if (mmalsrc->port_failed)
+		return;
+
+	/* Only the frame just dequeued is left for the camera to fill */
+	if (outstanding + 1 >= mmalsrc->pool_size)
+		mmalsrc->pool_dry++;
+	mmalsrc->pool_peak = MAX(mmalsrc->pool_peak, outstanding);
+
+	if (++mmalsrc->pool_frames < MMALSRC_POOL_WINDOW)
+		return;
+
+	hold = g_atomic_int_get(&mmalsrc->hold_sum);
+	g_atomic_int_add(&mmalsrc->hold_sum, -hold);
+	count = g_atomic_int_get(&mmalsrc->hold_count);
+	g_atomic_int_add(&mmalsrc->hold_count, -count);
+
+	/* Frames pushed while a header is held downstream */
+	if (count > 0 && mmalsrc->framerate.num > 0)
+		need = gst_util_uint64_scale_ceil(hold / count,
+				mmalsrc->framerate.num,
+				(guint64) mmalsrc->framerate.den * G_USEC_PER_SEC);
+
+	target = MAX(need, mmalsrc->pool_peak) + MMALSRC_POOL_HEADROOM;
+	if (mmalsrc->pool_dry)
+		target = MAX(target, mmalsrc->pool_size + 1);
+	target = CLAMP(target, mmalsrc->cam_pool->headers_num, mmalsrc->pool_limit);
+
+	GST_DEBUG("pool : size %d, peak %d, dry %d, hold %d us, target %d",
+			mmalsrc->pool_size, mmalsrc->pool_peak, mmalsrc->pool_dry,
+			count > 0 ? hold / count : 0, target);
+
+	if (target > mmalsrc->pool_size) {
+		mmalsrc->pool_shrink = 0;
+		gst_mmalsrc_pool_reconfigure(mmalsrc, target);
+	} else if (target < mmalsrc->pool_size
+			&& ++mmalsrc->pool_shrink >= MMALSRC_POOL_SHRINK_WINDOWS) {
+		mmalsrc->pool_shrink = 0;
+		gst_mmalsrc_pool_reconfigure(mmalsrc, mmalsrc->pool_size - 1);
+	} else if (target >= mmalsrc->pool_size) {
+		mmalsrc->pool_shrink = 0;
+	}
+
+	mmalsrc->pool_peak = outstanding;
+	mmalsrc->pool_dry = 0;
+	mmalsrc->pool_frames = 0;
+}
+
+/******************************************************************
+ ******************************************************************
+ * Core functions
+ ******************************************************************
+ ******************************************************************/
+
+/*******************************************************************
+ * gst_mmalsrc_camera_destroy
+ *
+ * Disable a camera and its ports, so that it lets the sensor go even
+ * while retired pools hold a reference on it, and drop ours. Only the
+ * memory of the pools outlives it.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_camera_destroy(MMAL_COMPONENT_T *camera) {
+	guint i;
+
+	for (i = 0; i < camera->output_num; i++)
+		if (camera->output[i]->is_enabled)
+			mmal_port_disable(camera->output[i]);
+	if (camera->control->is_enabled)
+		mmal_port_disable(camera->control);
+	if (camera->is_enabled)
+		mmal_component_disable(camera);
+	mmal_component_destroy(camera);
+}
+
+/*******************************************************************
+ * destroy_camera_component
+ *
+ * Destroy MMAL camera component
+ *
+ ******************************************************************/
+static void destroy_camera_component(GstMMALSrc *mmalsrc) {
+
+	if (mmalsrc) {
+		gst_mmalsrc_camera_destroy(mmalsrc->camera_component);
+		mmalsrc->camera_component = NULL;
+		if (mmalsrc->camera2_component) {
+			gst_mmalsrc_camera_destroy(mmalsrc->camera2_component);
+			mmalsrc->camera2_component = NULL;
+		}
+		GST_INFO("MMAL camera component destroyed.");
+	}
+}
+
+/*******************************************************************
+ * gst_mmalsrc_camera_new
+ *
+ * Create the component of camera num, set the parameters and enable
+ * it. Return NULL on failure.
+ *
+ ******************************************************************/
+static MMAL_COMPONENT_T *gst_mmalsrc_camera_new(GstMMALSrc *mmalsrc,
+		gint32 num) {
+	MMAL_STATUS_T status;
+	MMAL_COMPONENT_T *camera = 0;
+	MMAL_PORT_T *port;
+	guint i;
+
+	//Camera parameter
+	MMAL_PARAMETER_CHANGE_EVENT_REQUEST_T change_event_request = { {
+			MMAL_PARAMETER_CHANGE_EVENT_REQUEST,
+			sizeof(MMAL_PARAMETER_CHANGE_EVENT_REQUEST_T) }, 0, 1 };
+
+	MMAL_PARAMETER_BOOLEAN_T camera_capture = { { MMAL_PARAMETER_CAPTURE,
+			sizeof(camera_capture) }, 1 };
+
+	MMAL_PARAMETER_INT32_T camera_num = { { MMAL_PARAMETER_CAMERA_NUM,
+			sizeof(camera_num) }, num };
+
+	MMAL_PARAMETER_UINT32_T camera_iso = { { MMAL_PARAMETER_ISO,
+			sizeof(camera_iso) }, mmalsrc->iso };
+
+
+	MMAL_PARAMETER_EXPOSUREMODE_T camera_exposure;
+
+	//Exposure => on : MMAL_PARAM_EXPOSUREMODE_AUTO; off = MMAL_PARAM_EXPOSUREMODE_OFF
+	if (strcmp(mmalsrc->exposure, MMALSRC_EXPOSURE_ON) == 0) { //if "on"
+		camera_exposure.hdr.id = MMAL_PARAMETER_EXPOSURE_MODE;
+		camera_exposure.hdr.size = sizeof(camera_exposure);
+		camera_exposure.value = MMAL_PARAM_EXPOSUREMODE_AUTO;
+
+	} else { //if "off"
+		camera_exposure.hdr.id = MMAL_PARAMETER_EXPOSURE_MODE;
+		camera_exposure.hdr.size = sizeof(camera_exposure);
+		camera_exposure.value = MMAL_PARAM_EXPOSUREMODE_OFF;
+	}
+
+	/************** CREATE CAMERA COMPONENT **************/
+	status = mmal_component_create(MMAL_COMPONENT_DEFAULT_CAMERA, &camera);
+
+	if (status != MMAL_SUCCESS) {
+		GST_ERROR("%s: couldn't create camera", __func__);
+		goto error;
+	}
+	GST_INFO("%s: mmal camera component created", __func__);
+
+	if (!camera->output_num) {
+		GST_ERROR("camera doesn't have output ports");
+		status = MMAL_EINVAL;
+		goto error;
+	}
+
+	// Camera port is of type "video port"
+	port = camera->output[MMAL_CAMERA_VIDEO_PORT];
+
+
+
+	/************** PARAMETERS**************/
+	//- Camera capture
+	status = mmal_port_parameter_set(port, &camera_capture.hdr);
+	if (status != MMAL_SUCCESS && status != MMAL_ENOSYS) {
+		GST_ERROR("Error no camera capture");
+		goto error;
+	}
+
+	//- Camera num
+	status = mmal_port_parameter_set(camera->control, &camera_num.hdr);
+
+	if (status != MMAL_SUCCESS && status != MMAL_ENOSYS) {
+		GST_ERROR("Could not select camera : error %d", status);
+		goto error;
+	}
+
+	//- Stereoscopic mode, on every output port
+	if (mmalsrc->stereo != MMAL_STEREOSCOPIC_MODE_NONE) {
+		MMAL_PARAMETER_STEREOSCOPIC_MODE_T camera_stereo = { {
+				MMAL_PARAMETER_STEREOSCOPIC_MODE, sizeof(camera_stereo) },
+				mmalsrc->stereo, MMAL_TRUE, MMAL_FALSE };
+
+		for (i = 0; i < camera->output_num; i++) {
+			status = mmal_port_parameter_set(camera->output[i],
+					&camera_stereo.hdr);
+
+			if (status != MMAL_SUCCESS) {
+				GST_ERROR("Could not set stereoscopic mode : error %d", status);
+				goto error;
+			}
+		}
+	}
+
+	//- Camera exposure
+	status = mmal_port_parameter_set(camera->control, &camera_exposure.hdr);
+
+	if (status != MMAL_SUCCESS && status != MMAL_ENOSYS) {
+		GST_ERROR("Could not set exposure : error %d", status);
+		goto error;
+	}
+
+	//- Camera ISO
+	status = mmal_port_parameter_set(camera->control, &camera_iso.hdr);
+
+	if (status != MMAL_SUCCESS && status != MMAL_ENOSYS) {
+		GST_ERROR("Could not set iso : error %d", status);
+		goto error;
+	}
+
+	// If shutter activation is on, we set the shutter period (in microseconds)
+	if (strcmp(mmalsrc->shutter_activation, "on") == 0) {
+		MMAL_PARAMETER_UINT32_T camera_shutter = { {
+				MMAL_PARAMETER_SHUTTER_SPEED, sizeof(camera_shutter) },
+				mmalsrc->shutter_period };
+
+		//- Camera shutter
+		status = mmal_port_parameter_set(camera->control, &camera_shutter.hdr);
+
+		if (status != MMAL_SUCCESS && status != MMAL_ENOSYS) {
+			GST_ERROR("Could not set camera shutter : error %d", status);
+			goto error;
+		}
+	}
+
+	// Raw STC frame timestamps, to be mapped on the monotonic clock
+	// and shared by both cameras of a pair
+	if (mmalsrc->tracing || mmalsrc->stereo_pair) {
+		MMAL_PARAMETER_CAMERA_STC_MODE_T camera_stc = { {
+				MMAL_PARAMETER_USE_STC, sizeof(camera_stc) },
+				MMAL_PARAM_TIMESTAMP_MODE_RAW_STC };
+
+		status = mmal_port_parameter_set(camera->control, &camera_stc.hdr);
+
+		if (status != MMAL_SUCCESS && status != MMAL_ENOSYS) {
+			GST_ERROR("Could not set camera STC mode : error %d", status);
+			goto error;
+		}
+	}
+
+	/************** ENABLE CONTROL PORT **************/
+	status = mmal_port_enable(camera->control, control_bh_cb);
+
+	if (status != MMAL_SUCCESS) {
+		GST_ERROR("Unable to enable control port : error %d", status);
+		goto error;
+	}
+
+	GST_INFO("control port enabled");
+
+	/************** ENABLE CAMERA COMPONENT **************/
+	status = mmal_component_enable(camera);
+	if (status) {
+		GST_ERROR("%s: camera component couldn't be enabled", __func__);
+		goto error;
+	}
+
+	return camera;
+
+error:
+	if (camera)
+		mmal_component_destroy(camera);
+
+	return NULL;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_camera_create
+ *
+ * Create the camera components, camera 0 and the second camera of a
+ * stereo pair. Return TRUE on success.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_camera_create(GstMMALSrc *mmalsrc) {
+	mmalsrc->camera_component = gst_mmalsrc_camera_new(mmalsrc, 0);
+	if (!mmalsrc->camera_component)
+		return FALSE;
+	mmalsrc->cam_port =
+			mmalsrc->camera_component->output[MMAL_CAMERA_VIDEO_PORT];
+	if (mmalsrc->raw && !gst_mmalsrc_raw_select(mmalsrc))
+		return FALSE;
+
+	if (mmalsrc->stereo_pair) {
+		mmalsrc->camera2_component = gst_mmalsrc_camera_new(mmalsrc,
+				MMALSRC_STEREO_SECOND_CAMERA);
+		if (!mmalsrc->camera2_component)
+			return FALSE;
+		mmalsrc->cam2_port =
+				mmalsrc->camera2_component->output[MMAL_CAMERA_VIDEO_PORT];
+	}
+
+	return TRUE;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_start
+ *
+ * Create the camera component, set the parameters and enable stream.
+ * Return TRUE on success.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_start(GstBaseSrc * src) {
+	GstMMALSrc *mmalsrc = GST_MMALSRC(src);
+	gboolean ret = TRUE;
+
+	mmalsrc->first_port_config = 0;
+	mmalsrc->recovery_start = 0;
+	mmalsrc->recoveries = 0;
+	mmalsrc->discont = FALSE;
+	mmalsrc->port_failed = FALSE;
+
+	mmalsrc->tracing = strcmp(mmalsrc->latency_tracing,
+			MMALSRC_LATENCY_TRACING_ON) == 0;
+
+	mmalsrc->stereo = MMAL_STEREOSCOPIC_MODE_NONE;
+	if (strcmp(mmalsrc->stereo_mode, MMALSRC_STEREO_MODE_SIDE_BY_SIDE) == 0)
+		mmalsrc->stereo = MMAL_STEREOSCOPIC_MODE_SIDE_BY_SIDE;
+	else if (strcmp(mmalsrc->stereo_mode, MMALSRC_STEREO_MODE_TOP_BOTTOM) == 0)
+		mmalsrc->stereo = MMAL_STEREOSCOPIC_MODE_TOP_BOTTOM;
+	mmalsrc->stereo_pair = strcmp(mmalsrc->stereo_mode,
+			MMALSRC_STEREO_MODE_PAIR) == 0;
+	mmalsrc->pair_unmatched = 0;
+
+	mmalsrc->batching = mmalsrc->batch_size > 1;
+	g_atomic_int_set(&mmalsrc->preroll_flush, 0);
+	g_atomic_int_set(&mmalsrc->preroll_holding, mmalsrc->preroll_hold);
+	mmalsrc->preroll_resume = FALSE;
+	gst_segment_init(&mmalsrc->preroll_stream, GST_FORMAT_TIME);
+	mmalsrc->pushed_end = GST_CLOCK_TIME_NONE;
+	mmalsrc->streaming_thread_ready = FALSE;
+
+	bcm_host_init();
+
+	if (vcos_event_flags_create(&events, "mmalsrc") != VCOS_SUCCESS) {
+		GST_ERROR("%s: failed to create event", __func__);
+		goto error;
+	}
+
+	if (!gst_mmalsrc_camera_create(mmalsrc))
+		goto error;
+
+	if (mmalsrc->tracing)
+		mmalsrc->latency_probe = gst_pad_add_probe(GST_BASE_SRC_PAD(mmalsrc),
+				GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+				gst_mmalsrc_latency_probe, mmalsrc, NULL);
+	if (mmalsrc->preroll_duration)
+		mmalsrc->preroll_probe = gst_pad_add_probe(GST_BASE_SRC_PAD(mmalsrc),
+				GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+				gst_mmalsrc_preroll_probe, mmalsrc, NULL);
+
+	GST_INFO("%s: camera component created", __func__);
+
+	return ret;
+
+error:
+	GST_ERROR("%s: Failed to create camera component", __func__);
+	ret = FALSE;
+	return ret;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_stop
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_stop(GstBaseSrc * src) {
+	GstMMALSrc *mmalsrc = GST_MMALSRC(src);
+	gboolean ret = TRUE;
+
+	GST_INFO("stop function");
+	if (mmalsrc->latency_probe) {
+		gst_pad_remove_probe(GST_BASE_SRC_PAD(mmalsrc), mmalsrc->latency_probe);
+		mmalsrc->latency_probe = 0;
+	}
+	if (mmalsrc->preroll_probe) {
+		gst_pad_remove_probe(GST_BASE_SRC_PAD(mmalsrc), mmalsrc->preroll_probe);
+		mmalsrc->preroll_probe = 0;
+	}
+	vcos_event_flags_delete(&events);
+
+	// The pools are retired while their ports still exist
+	if (mmalsrc->cam_pool)
+		gst_mmalsrc_port_teardown(mmalsrc);
+	if (mmalsrc->raw)
+		gst_mmalsrc_raw_release(mmalsrc);
+	destroy_camera_component(mmalsrc);
+	gst_mmalsrc_capture_restore(mmalsrc);
+
+	mmal_queue_destroy(mmalsrc->queue_video_frames);
+	mmalsrc->queue_video_frames = NULL;
+	gst_mmalsrc_pool_release(mmalsrc);
+	if (mmalsrc->queue_pair_frames) {
+		mmal_queue_destroy(mmalsrc->queue_pair_frames);
+		mmalsrc->queue_pair_frames = NULL;
+	}
+	mmalsrc->pair_pending = NULL;
+	if (mmalsrc->ring_fd >= 0) {
+		close(mmalsrc->ring_fd);
+		mmalsrc->ring_fd = -1;
+	}
+	if (mmalsrc->unpack_pool) {
+		g_thread_pool_free(mmalsrc->unpack_pool, FALSE, TRUE);
+		mmalsrc->unpack_pool = NULL;
+	}
+	gst_mmalsrc_motion_release(mmalsrc);
+	gst_mmalsrc_pyramid_release(mmalsrc);
+	gst_mmalsrc_preroll_release(mmalsrc);
+	if (mmalsrc->preroll_pending) {
+		gst_buffer_list_unref(mmalsrc->preroll_pending);
+		mmalsrc->preroll_pending = NULL;
+	}
+
+	return ret;
+}
+
+/*******************************************************************
+ * gst_release_buffer_cb
+ *
+ * Buffer release when GStreamer is done using it.
+ * Account how long the header was held for the pool sizing.
+ *
+ ******************************************************************/
+static void gst_release_buffer_cb(gpointer data) {
+
+	MMAL_BUFFER_HEADER_T *d = (MMAL_BUFFER_HEADER_T *) data;
+	GstMMALSrcHeaderInfo *info;
+	GstMMALSrcRetiredPool *orphan = NULL;
+
+	g_mutex_lock(&retired_lock);
+	info = (GstMMALSrcHeaderInfo *) d->user_data;
+	if (info && info->mmalsrc) {
+		GstMMALSrc *mmalsrc = info->mmalsrc;
+		/* Capped so that a window of holds fits in a gint */
+		gint64 hold = CLAMP(g_get_monotonic_time() - info->pushed, 0,
+				10 * G_USEC_PER_SEC);
+
+		g_atomic_int_add(&mmalsrc->hold_sum, (gint) hold);
+		g_atomic_int_inc(&mmalsrc->hold_count);
+		g_atomic_int_add(&mmalsrc->outstanding, -1);
+	}
+	mmal_buffer_header_release(d);
+
+	// The last header of a pool the element let go destroys it
+	if (info && info->retired && info->retired->orphan
+			&& gst_mmalsrc_pool_home(info->retired->pool)) {
+		orphan = info->retired;
+		orphan->orphan = FALSE;
+	}
+	g_mutex_unlock(&retired_lock);
+
+	if (orphan)
+		gst_mmalsrc_pool_retired_free(orphan);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_send_pool_buffers
+ *
+ * Send every free header of a pool back to a camera port.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_send_pool_buffers(MMAL_PORT_T *port,
+		MMAL_POOL_T *pool) {
+	MMAL_BUFFER_HEADER_T *buffer_h;
+	MMAL_STATUS_T status;
+
+	while ((buffer_h = mmal_queue_get(pool->queue)) != NULL) {
+		status = mmal_port_send_buffer(port, buffer_h);
+		if (status != MMAL_SUCCESS) {
+			GST_INFO("Error when sending EMPTY buffer to camera port");
+		}
+	}
+}
+
+/*******************************************************************
+ * gst_mmalsrc_send_empty_buffers
+ *
+ * Send the free headers of cam_pool and of the active extra headers,
+ * and those of the second camera of a stereo pair.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_send_empty_buffers(GstMMALSrc *mmalsrc) {
+	guint i;
+
+	gst_mmalsrc_send_pool_buffers(mmalsrc->cam_port, mmalsrc->cam_pool);
+	for (i = 0; i < mmalsrc->extra_active; i++)
+		gst_mmalsrc_send_pool_buffers(mmalsrc->cam_port,
+				mmalsrc->extra[i].pool);
+
+	if (mmalsrc->cam2_pool)
+		gst_mmalsrc_send_pool_buffers(mmalsrc->cam2_port, mmalsrc->cam2_pool);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_recycle_buffer
+ *
+ * Give a frame that won't be pushed straight back to the camera.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_recycle_buffer(GstMMALSrc *mmalsrc,
+		MMAL_BUFFER_HEADER_T *buffer_h) {
+	mmal_buffer_header_release(buffer_h);
+	gst_mmalsrc_send_empty_buffers(mmalsrc);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_unpack_slice
+ *
+ * Unpack raw lines [first, last) of a frame.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_unpack_slice(GstMMALSrc *mmalsrc, const guint8 *src,
+		guint8 *dst, guint first, guint last) {
+	guint y;
+
+	for (y = first; y < last; y++)
+		gst_mmal_unpack_line(src + y * mmalsrc->raw_stride,
+				dst + y * mmalsrc->raw_out_stride, mmalsrc->width,
+				mmalsrc->raw_bits, mmalsrc->raw_out_bits, mmalsrc->raw_shift);
+}
+
+typedef struct {
+	const guint8 *src;
+	guint8 *dst;
+	guint first;
+	guint last;
+} GstMMALSrcUnpackJob;
+
+/*******************************************************************
+ * gst_mmalsrc_unpack_job
+ *
+ * Thread pool function, unpack one slice and signal its completion.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_unpack_job(gpointer data, gpointer user_data) {
+	GstMMALSrcUnpackJob *job = (GstMMALSrcUnpackJob *) data;
+	GstMMALSrc *mmalsrc = GST_MMALSRC(user_data);
+
+	gst_mmalsrc_unpack_slice(mmalsrc, job->src, job->dst, job->first,
+			job->last);
+
+	g_mutex_lock(&mmalsrc->unpack_lock);
+	if (--mmalsrc->unpack_pending == 0)
+		g_cond_signal(&mmalsrc->unpack_cond);
+	g_mutex_unlock(&mmalsrc->unpack_lock);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_unpack_frame
+ *
+ * Unpack a raw frame into a new GstBuffer. Rows are split in slices
+ * between the streaming thread and the unpack threads.
+ *
+ ******************************************************************/
+static GstBuffer *gst_mmalsrc_unpack_frame(GstMMALSrc *mmalsrc,
+		MMAL_BUFFER_HEADER_T *buffer_h) {
+	GstMMALSrcUnpackJob jobs[MMALSRC_MAX_BAYER_THREADS];
+	const guint8 *src = buffer_h->data + buffer_h->offset;
+	guint slices = mmalsrc->unpack_pool ? mmalsrc->bayer_threads : 1;
+	GstBuffer *out;
+	GstMapInfo map;
+	guint i;
+
+	if (buffer_h->length < mmalsrc->raw_stride * mmalsrc->height) {
+		GST_ERROR("raw frame too short : %d bytes", buffer_h->length);
+		return NULL;
+	}
+
+	out = gst_buffer_new_allocate(NULL,
+			mmalsrc->raw_out_stride * mmalsrc->height, NULL);
+	if (!out || !gst_buffer_map(out, &map, GST_MAP_WRITE)) {
+		GST_ERROR("couldn't allocate unpacked frame");
+		if (out)
+			gst_buffer_unref(out);
+		return NULL;
+	}
+
+	for (i = 0; i < slices; i++) {
+		jobs[i].src = src;
+		jobs[i].dst = map.data;
+		jobs[i].first = i * mmalsrc->height / slices;
+		jobs[i].last = (i + 1) * mmalsrc->height / slices;
+	}
+
+	mmalsrc->unpack_pending = slices - 1;
+	for (i = 1; i < slices; i++)
+		g_thread_pool_push(mmalsrc->unpack_pool, &jobs[i], NULL);
+
+	gst_mmalsrc_unpack_slice(mmalsrc, src, map.data, jobs[0].first,
+			jobs[0].last);
+
+	g_mutex_lock(&mmalsrc->unpack_lock);
+	while (mmalsrc->unpack_pending > 0)
+		g_cond_wait(&mmalsrc->unpack_cond, &mmalsrc->unpack_lock);
+	g_mutex_unlock(&mmalsrc->unpack_lock);
+
+	gst_buffer_unmap(out, &map);
+	return out;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pair_match
+ *
+ * Find the frame of the second camera shot with a frame of camera 0,
+ * their pts (shared STC) within stereo-tolerance. Older second frames
+ * are given back, a newer one is kept for the next first frame.
+ * Return NULL if there is no pair.
+ *
+ ******************************************************************/
+static MMAL_BUFFER_HEADER_T *gst_mmalsrc_pair_match(GstMMALSrc *mmalsrc,
+		MMAL_BUFFER_HEADER_T *buffer_h) {
+	guint wait = mmalsrc->stereo_tolerance / 1000
+			+ MMALSRC_STEREO_WAIT_MARGIN_MS;
+	MMAL_BUFFER_HEADER_T *second;
+	gint64 diff;
+
+	for (;;) {
+		second = mmalsrc->pair_pending;
+		if (!second)
+			second = mmal_queue_timedwait(mmalsrc->queue_pair_frames, wait);
+		mmalsrc->pair_pending = NULL;
+		if (!second)
+			return NULL;
+
+		// Unknown timestamps : pair in arrival order
+		if (buffer_h->pts == MMAL_TIME_UNKNOWN
+				|| second->pts == MMAL_TIME_UNKNOWN)
+			return second;
+
+		diff = second->pts - buffer_h->pts;
+		if (ABS(diff) <= (gint64) mmalsrc->stereo_tolerance)
+			return second;
+
+		if (diff > 0) {
+			mmalsrc->pair_pending = second;
+			return NULL;
+		}
+
+		mmal_buffer_header_release(second);
+	}
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pair_recycle
+ *
+ * Give a frame, and its stereo pair if any, back to the cameras.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_pair_recycle(GstMMALSrc *mmalsrc,
+		MMAL_BUFFER_HEADER_T *buffer_h, MMAL_BUFFER_HEADER_T *buffer2_h) {
+	if (buffer2_h)
+		mmal_buffer_header_release(buffer2_h);
+	gst_mmalsrc_recycle_buffer(mmalsrc, buffer_h);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pair_wrap
+ *
+ * Wrap the frames of a stereo pair in one buffer : one memory and
+ * one GstVideoMeta per view, view 0 from camera 0.
+ *
+ ******************************************************************/
+static GstBuffer *gst_mmalsrc_pair_wrap(GstMMALSrc *mmalsrc,
+		MMAL_BUFFER_HEADER_T *first, MMAL_BUFFER_HEADER_T *second) {
+	MMAL_BUFFER_HEADER_T *views[2] = { first, second };
+	guint sizes[2] = { mmalsrc->cam_port->buffer_size,
+			mmalsrc->cam2_port->buffer_size };
+	GstVideoInfo *info = &mmalsrc->frame_info;
+	gsize offset[GST_VIDEO_MAX_PLANES];
+	GstBuffer *buf = gst_buffer_new();
+	GstVideoMeta *meta;
+	gsize base = 0;
+	guint i, p;
+
+	for (i = 0; i < 2; i++) {
+		gst_buffer_append_memory(buf,
+				gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
+						views[i]->data, sizes[i], 0, sizes[i], views[i],
+						(GDestroyNotify) gst_release_buffer_cb));
+
+		for (p = 0; p < GST_VIDEO_INFO_N_PLANES(info); p++)
+			offset[p] = base + GST_VIDEO_INFO_PLANE_OFFSET(info, p);
+
+		meta = gst_buffer_add_video_meta_full(buf, GST_VIDEO_FRAME_FLAG_NONE,
+				GST_VIDEO_INFO_FORMAT(info), mmalsrc->width, mmalsrc->height,
+				GST_VIDEO_INFO_N_PLANES(info), offset, info->stride);
+		meta->id = i;
+
+		base += sizes[i];
+	}
+
+	return buf;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_ring_wait
+ *
+ * Wait up to timeout ms for a frame from the ring. Return NULL on
+ * timeout or unlock.
+ *
+ ******************************************************************/
+static MMAL_BUFFER_HEADER_T *gst_mmalsrc_ring_wait(GstMMALSrc *mmalsrc,
+		guint timeout) {
+	MMAL_BUFFER_HEADER_T *buffer_h;
+	struct pollfd pfd;
+	uint64_t count;
+	int ready;
+
+	pfd.fd = mmalsrc->ring_fd;
+	pfd.events = POLLIN;
+
+	while ((buffer_h = gst_mmalsrc_ring_get(&mmalsrc->ring)) == NULL) {
+		if (mmalsrc->unlock)
+			return NULL;
+
+		ready = poll(&pfd, 1, timeout);
+		if (ready < 0 && errno != EINTR) {
+			GST_ERROR("ring poll failed : %s", strerror(errno));
+			return NULL;
+		}
+		if (ready == 0)
+			return gst_mmalsrc_ring_get(&mmalsrc->ring);
+
+		/* Reset the counter, the ring itself tells what is ready */
+		if (read(mmalsrc->ring_fd, &count, sizeof(count)) < 0
+				&& errno != EAGAIN)
+			GST_WARNING("ring read failed : %s", strerror(errno));
+	}
+
+	return buffer_h;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_pair_setup
+ *
+ * Set the port of the second camera like the camera 0 one, create its
+ * pool and enable it. Return TRUE on success.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_pair_setup(GstMMALSrc *mmalsrc) {
+	MMAL_PORT_T *port = mmalsrc->cam2_port;
+	MMAL_STATUS_T status;
+
+	mmal_format_copy(port->format, mmalsrc->cam_port->format);
+	status = mmal_port_format_commit(port);
+	if (status != MMAL_SUCCESS) {
+		GST_ERROR("second camera port format couldn't be set");
+		return FALSE;
+	}
+
+	port->buffer_size = MAX(port->buffer_size_recommended,
+			port->buffer_size_min);
+	port->buffer_num = MAX(MMALSRC_FRMBUF_COUNT, port->buffer_num_min);
+
+	mmalsrc->cam2_pool = mmal_port_pool_create(port, port->buffer_num,
+			port->buffer_size);
+	if (!mmalsrc->cam2_pool) {
+		GST_ERROR("failed to create pool for %s", port->name);
+		return FALSE;
+	}
+
+	if (!mmalsrc->queue_pair_frames)
+		mmalsrc->queue_pair_frames = mmal_queue_create();
+	if (!mmalsrc->queue_pair_frames) {
+		GST_ERROR("failed to create queue pair frames");
+		return FALSE;
+	}
+
+	port->userdata = (void *) mmalsrc;
+	mmalsrc->pair_pending = NULL;
+
+	status = mmal_port_enable(port, gst_mmalsrc_pair_port_cb);
+	if (status != MMAL_SUCCESS) {
+		GST_ERROR("failed to enable %s", port->name);
+		return FALSE;
+	}
+	GST_INFO("second camera port enabled");
+
+	return TRUE;
+}
 
 /*******************************************************************
- * destroy_camera_component
+ * gst_mmalsrc_pair_teardown
  *
- * Destroy MMAL camera component
+ * Disable the port of the second camera and retire its pool.
  *
  ******************************************************************/
-static void destroy_camera_component(GstMMALSrc *mmalsrc) {
+static void gst_mmalsrc_pair_teardown(GstMMALSrc *mmalsrc) {
+	MMAL_BUFFER_HEADER_T *buffer_h;
 
-	if (mmalsrc) {
-		mmal_component_destroy(mmalsrc->camera_component);
-		mmalsrc->camera_component = NULL;
-		GST_INFO("MMAL camera component destroyed.");
+	if (!mmalsrc->cam2_pool)
+		return;
+
+	if (mmalsrc->cam2_port->is_enabled)
+		mmal_port_disable(mmalsrc->cam2_port);
+
+	if (mmalsrc->pair_pending) {
+		mmal_buffer_header_release(mmalsrc->pair_pending);
+		mmalsrc->pair_pending = NULL;
 	}
+	while ((buffer_h = mmal_queue_get(mmalsrc->queue_pair_frames)) != NULL)
+		mmal_buffer_header_release(buffer_h);
+
+	gst_mmalsrc_pool_retire_one(mmalsrc, mmalsrc->cam2_port, mmalsrc->cam2_pool,
+			NULL);
+	mmalsrc->cam2_pool = NULL;
 }
 
 /*******************************************************************
- * gst_mmalsrc_start
+ * gst_mmalsrc_port_setup
  *
- * Create the camera component, set the parameters and enable stream.
- * Return TRUE on success.
+ * Set the camera port format from the negotiated caps, create the
+ * pool and enable the port. Return TRUE on success.
  *
  ******************************************************************/
-static gboolean gst_mmalsrc_start(GstBaseSrc * src) {
-	GstMMALSrc *mmalsrc = GST_MMALSRC(src);
-	gboolean ret = TRUE;
+static gboolean gst_mmalsrc_port_setup(GstMMALSrc *mmalsrc) {
 	MMAL_STATUS_T status;
-	MMAL_COMPONENT_T *camera = 0;
 	MMAL_ES_FORMAT_T *format;
-	uint32_t width, height;
-
-	mmalsrc->first_port_config = 0;
 
-	//Camera parameter
-	MMAL_PARAMETER_CHANGE_EVENT_REQUEST_T change_event_request = { {
-			MMAL_PARAMETER_CHANGE_EVENT_REQUEST,
-			sizeof(MMAL_PARAMETER_CHANGE_EVENT_REQUEST_T) }, 0, 1 };
+	if (mmalsrc->stereo_pair && mmalsrc->raw) {
+		GST_ERROR("stereo pairs are only captured as video/x-raw");
+		return FALSE;
+	}
 
-	MMAL_PARAMETER_BOOLEAN_T camera_capture = { { MMAL_PARAMETER_CAPTURE,
-			sizeof(camera_capture) }, 1 };
+	/************** CAMERA PORT **************/
+	/* Set up the port format */
+	format = mmalsrc->cam_port->format;
+
+	format->type = MMAL_ES_TYPE_VIDEO;
+	format->encoding = mmalsrc->encoding;
+	format->es->video.width = mmalsrc->width;
+	format->es->video.height = mmalsrc->height;
+	format->es->video.crop.x = 0;
+	format->es->video.crop.y = 0;
+	format->es->video.crop.width = mmalsrc->width;
+	format->es->video.crop.height = mmalsrc->height;
+	format->es->video.frame_rate.num = mmalsrc->framerate.num;
+	format->es->video.frame_rate.den = mmalsrc->framerate.den;
+	format->es->video.par.num = MMALSRC_PAR_NUM;
+	format->es->video.par.den = MMALSRC_PAR_DEN;
+
+	status = mmal_port_format_commit(mmalsrc->cam_port);
+	if (status != MMAL_SUCCESS) {
+		GST_ERROR("camera output port format couldn't be set");
+		return FALSE;
+	}
 
-	MMAL_PARAMETER_INT32_T camera_num = { { MMAL_PARAMETER_CAMERA_NUM,
-			sizeof(camera_num) }, 0 };
+	/* set port size */
+	mmalsrc->cam_port->buffer_size =
+			mmalsrc->cam_port->buffer_size_recommended;
 
-	MMAL_PARAMETER_UINT32_T camera_iso = { { MMAL_PARAMETER_ISO,
-			sizeof(camera_iso) }, mmalsrc->iso };
+	if (mmalsrc->cam_port->buffer_size
+			< mmalsrc->cam_port->buffer_size_min)
+		mmalsrc->cam_port->buffer_size =
+				mmalsrc->cam_port->buffer_size_min;
 
+	/* Create pool of buffer headers for the output port to consume */
+	if (!gst_mmalsrc_pool_setup(mmalsrc)) {
+		GST_ERROR("failed to create pool for %s",
+				mmalsrc->cam_port->name);
+		return FALSE;
+	}
 
-	MMAL_PARAMETER_EXPOSUREMODE_T camera_exposure;
+	/* Display buffer information */
+	GST_INFO("%s: buffer size recommended %d", __func__,
+			mmalsrc->cam_port->buffer_size_recommended);
+	GST_INFO("%s: buffer size: %d", __func__,
+			mmalsrc->cam_port->buffer_size);
 
-	//Exposure => on : MMAL_PARAM_EXPOSUREMODE_AUTO; off = MMAL_PARAM_EXPOSUREMODE_OFF
-	if (strcmp(mmalsrc->exposure, MMALSRC_EXPOSURE_ON) == 0) { //if "on"
-		camera_exposure.hdr.id = MMAL_PARAMETER_EXPOSURE_MODE;
-		camera_exposure.hdr.size = sizeof(camera_exposure);
-		camera_exposure.value = MMAL_PARAM_EXPOSUREMODE_AUTO;
+	GST_INFO("%s: buffer num recommended : %d", __func__,
+			mmalsrc->cam_port->buffer_num_recommended);
+	GST_INFO("%s: buffer num min : %d", __func__,
+			mmalsrc->cam_port->buffer_num_min);
+	GST_INFO("%s: buffer num : %d", __func__,
+			mmalsrc->cam_port->buffer_num);
+	GST_INFO("%s: pool size : %d", __func__, mmalsrc->pool_size);
 
-	} else { //if "off"
-		camera_exposure.hdr.id = MMAL_PARAMETER_EXPOSURE_MODE;
-		camera_exposure.hdr.size = sizeof(camera_exposure);
-		camera_exposure.value = MMAL_PARAM_EXPOSUREMODE_OFF;
-	}
+	// Create a queue to store our video frames. The callback we will get when
+	// a frame has been decoded will put the frame into this queue.
 
-	bcm_host_init();
+	if (!mmalsrc->queue_video_frames)
+		mmalsrc->queue_video_frames = mmal_queue_create();
 
-	if (vcos_event_flags_create(&events, "mmalsrc") != VCOS_SUCCESS) {
-		GST_ERROR("%s: failed to create event", __func__);
-		goto error;
+	if (!mmalsrc->queue_video_frames) {
+		GST_ERROR("failed to create queue video frames");
+		return FALSE;
+	}
+	mmalsrc->cam_port->userdata = (void *) mmalsrc;
+
+	/* Lock-free ring between the callback and the streaming thread */
+	mmalsrc->use_ring = strcmp(mmalsrc->capture_mode,
+			MMALSRC_CAPTURE_MODE_RING) == 0;
+	mmalsrc->ring.head = 0;
+	mmalsrc->ring.tail = 0;
+
+	if (mmalsrc->use_ring) {
+		if (mmalsrc->cam_port->buffer_num > MMALSRC_RING_SIZE) {
+			GST_ERROR("%d buffers don't fit in the frame ring",
+					mmalsrc->cam_port->buffer_num);
+			return FALSE;
+		}
+		if (mmalsrc->ring_fd < 0)
+			mmalsrc->ring_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (mmalsrc->ring_fd < 0) {
+			GST_ERROR("failed to create ring eventfd : %s",
+					strerror(errno));
+			return FALSE;
+		}
 	}
 
-	/************** CREATE CAMERA COMPONENT **************/
-	status = mmal_component_create(MMAL_COMPONENT_DEFAULT_CAMERA, &camera);
-
+	/* Enable port with callback */
+	status = mmal_port_enable(mmalsrc->cam_port, generic_output_port_cb);
 	if (status != MMAL_SUCCESS) {
-		GST_ERROR("%s: couldn't create camera", __func__);
-		goto error;
+		GST_ERROR("failed to enable %s", mmalsrc->cam_port->name);
+		return FALSE;
 	}
-	GST_INFO("%s: mmal camera component created", __func__);
+	GST_INFO("camera port enabled with output callback");
 
-	if (!camera->output_num) {
-		GST_ERROR("camera doesn't have output ports");
-		status = MMAL_EINVAL;
-		goto error;
-	}
+	/* Raw Bayer frames from the sensor, bypassing the ISP */
+	if (mmalsrc->raw)
+		gst_mmalsrc_raw_trigger(mmalsrc);
 
-	// Camera port is of type "video port"
-	mmalsrc->cam_port = camera->output[MMAL_CAMERA_VIDEO_PORT];
+	if (mmalsrc->stereo_pair && !gst_mmalsrc_pair_setup(mmalsrc))
+		return FALSE;
 
+	gst_mmalsrc_motion_setup(mmalsrc);
+	gst_mmalsrc_pyramid_setup(mmalsrc);
+	gst_mmalsrc_preroll_setup(mmalsrc);
 
+	if (mmalsrc->tracing)
+		gst_mmalsrc_latency_setup(mmalsrc);
 
-	/************** PARAMETERS**************/
-	//- Camera capture
-	status = mmal_port_parameter_set(mmalsrc->cam_port, &camera_capture.hdr);
-	if (status != MMAL_SUCCESS && status != MMAL_ENOSYS) {
-		GST_ERROR("Error no camera capture");
-		goto error;
+	/* Helper threads unpacking the other slices of raw frames */
+	if (mmalsrc->raw && mmalsrc->raw_out_bits
+			&& mmalsrc->bayer_threads > 1 && !mmalsrc->unpack_pool) {
+		mmalsrc->unpack_pool = g_thread_pool_new(gst_mmalsrc_unpack_job,
+				mmalsrc, mmalsrc->bayer_threads - 1, TRUE, NULL);
+		if (!mmalsrc->unpack_pool)
+			GST_WARNING("no unpack threads, unpacking in streaming thread");
 	}
 
-	//- Camera num
-	status = mmal_port_parameter_set(camera->control, &camera_num.hdr);
+	/* First sensor frame is always pushed */
+	mmalsrc->decimate_acc = G_MAXUINT64 / 2;
 
-	if (status != MMAL_SUCCESS && status != MMAL_ENOSYS) {
-		GST_ERROR("Could not select camera : error %d", status);
-		goto error;
-	}
+	mmalsrc->last_frame = g_get_monotonic_time();
+	mmalsrc->frame_seen = FALSE;
 
-	//- Camera exposure
-	status = mmal_port_parameter_set(camera->control, &camera_exposure.hdr);
+	return TRUE;
+}
 
-	if (status != MMAL_SUCCESS && status != MMAL_ENOSYS) {
-		GST_ERROR("Could not set exposure : error %d", status);
-		goto error;
-	}
+/*******************************************************************
+ * gst_mmalsrc_port_teardown
+ *
+ * Disable the camera port and give back the frames it flushed. The
+ * pools are retired, headers held downstream keep theirs alive.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_port_teardown(GstMMALSrc *mmalsrc) {
+	if (mmalsrc->cam_port->is_enabled)
+		mmal_port_disable(mmalsrc->cam_port);
+	gst_mmalsrc_port_flush(mmalsrc);
 
-	//- Camera ISO
-	status = mmal_port_parameter_set(camera->control, &camera_iso.hdr);
+	gst_mmalsrc_pool_retire(mmalsrc);
+	gst_mmalsrc_pair_teardown(mmalsrc);
+}
 
-	if (status != MMAL_SUCCESS && status != MMAL_ENOSYS) {
-		GST_ERROR("Could not set iso : error %d", status);
-		goto error;
+/*******************************************************************
+ * gst_mmalsrc_watchdog_timeout
+ *
+ * Time without a frame, in microseconds, after which the camera is
+ * considered stalled.
+ *
+ ******************************************************************/
+static gint64 gst_mmalsrc_watchdog_timeout(GstMMALSrc *mmalsrc) {
+	gint64 timeout = 0;
+
+	if (mmalsrc->framerate.num > 0)
+		timeout = gst_util_uint64_scale(mmalsrc->watchdog_frames,
+				(guint64) mmalsrc->framerate.den * G_USEC_PER_SEC,
+				mmalsrc->framerate.num);
+
+	timeout = MAX(timeout, MMALSRC_WATCHDOG_MIN_MS * G_TIME_SPAN_MILLISECOND);
+
+	/* Sensor start up is slower than the frame period */
+	if (!mmalsrc->frame_seen)
+		timeout = MAX(timeout,
+				MMALSRC_WATCHDOG_STARTUP_MS * G_TIME_SPAN_MILLISECOND);
+
+	return timeout;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_recover
+ *
+ * Rebuild the camera component, port and pool after a stall, with
+ * the current properties and caps. The pipeline keeps running.
+ * Return FALSE if the camera couldn't be restarted.
+ *
+ ******************************************************************/
+static gboolean gst_mmalsrc_recover(GstMMALSrc *mmalsrc, gint64 stall) {
+	GST_ELEMENT_WARNING(mmalsrc, RESOURCE, READ,
+			("Camera stalled, restarting it"),
+			("no frame for %" G_GINT64_FORMAT " us", stall));
+
+	if (!mmalsrc->recovery_start)
+		mmalsrc->recovery_start = g_get_monotonic_time() - stall;
+
+	gst_mmalsrc_port_teardown(mmalsrc);
+	destroy_camera_component(mmalsrc);
+
+	if (!gst_mmalsrc_camera_create(mmalsrc)
+			|| !gst_mmalsrc_port_setup(mmalsrc)) {
+		GST_ELEMENT_ERROR(mmalsrc, RESOURCE, FAILED,
+				("Camera couldn't be restarted"), (NULL));
+		return FALSE;
 	}
 
-	// If shutter activation is on, we set the shutter period (in microseconds)
-	if (strcmp(mmalsrc->shutter_activation, "on") == 0) {
-		MMAL_PARAMETER_UINT32_T camera_shutter = { {
-				MMAL_PARAMETER_SHUTTER_SPEED, sizeof(camera_shutter) },
-				mmalsrc->shutter_period };
+	mmalsrc->discont = TRUE;
+	return TRUE;
+}
 
-		//- Camera shutter
-		status = mmal_port_parameter_set(camera->control, &camera_shutter.hdr);
+/*******************************************************************
+ * gst_mmalsrc_recovery_post
+ *
+ * First frame after a restart : post a "mmalsrc-recovery" element
+ * message with the time without frames, in microseconds.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_recovery_post(GstMMALSrc *mmalsrc) {
+	guint64 recovery = g_get_monotonic_time() - mmalsrc->recovery_start;
 
-		if (status != MMAL_SUCCESS && status != MMAL_ENOSYS) {
-			GST_ERROR("Could not set camera shutter : error %d", status);
-			goto error;
+	mmalsrc->recoveries++;
+	GST_INFO("camera recovered in %" G_GUINT64_FORMAT " us", recovery);
+
+	gst_element_post_message(GST_ELEMENT(mmalsrc),
+			gst_message_new_element(GST_OBJECT(mmalsrc),
+					gst_structure_new("mmalsrc-recovery",
+							"recovery-time", G_TYPE_UINT64, recovery,
+							"recoveries", G_TYPE_UINT, mmalsrc->recoveries,
+							NULL)));
+
+	mmalsrc->recovery_start = 0;
+}
+
+/*******************************************************************
+ * gst_mmalsrc_wait_frame
+ *
+ * Wait up to timeout ms for a frame, 0 to only take a frame already
+ * there. Return NULL on timeout or unlock.
+ *
+ ******************************************************************/
+static MMAL_BUFFER_HEADER_T *gst_mmalsrc_wait_frame(GstMMALSrc *mmalsrc,
+		guint timeout) {
+	if (mmalsrc->use_ring)
+		return gst_mmalsrc_ring_wait(mmalsrc, timeout);
+
+	if (!timeout)
+		return mmal_queue_get(mmalsrc->queue_video_frames);
+
+	return mmal_queue_timedwait(mmalsrc->queue_video_frames, timeout);
+}
+
+/*******************************************************************
+ * gst_mmalsrc_frame_select
+ *
+ * Apply the stereo pairing, pool sizing, decimation and change
+ * detection to a frame dequeued at dequeue. Return NULL if the frame
+ * was given back to the camera, else the frame, its stereo pair in
+ * buffer2_h and whether it is worth keeping in keep.
+ * The watchdog counts frames, or pairs in stereo pair mode, so that it
+ * also catches a stalled second camera.
+ *
+ ******************************************************************/
+static MMAL_BUFFER_HEADER_T *gst_mmalsrc_frame_select(GstMMALSrc *mmalsrc,
+		MMAL_BUFFER_HEADER_T *buffer_h, MMAL_BUFFER_HEADER_T **buffer2_h,
+		gboolean *keep, gboolean gate, gboolean drop, gint64 dequeue) {
+	*buffer2_h = NULL;
+
+	// Stereo pair : the second camera frame shot at the same time
+	if (mmalsrc->stereo_pair) {
+		*buffer2_h = gst_mmalsrc_pair_match(mmalsrc, buffer_h);
+		if (!*buffer2_h) {
+			if (++mmalsrc->pair_unmatched == MMALSRC_STEREO_UNMATCHED_WARNING)
+				GST_ELEMENT_WARNING(mmalsrc, RESOURCE, READ,
+						("No frame from the second camera"),
+						("%d frames of camera 0 without a pair",
+								mmalsrc->pair_unmatched));
+			GST_DEBUG("no stereo pair, %d frames unmatched",
+					mmalsrc->pair_unmatched);
+			gst_mmalsrc_recycle_buffer(mmalsrc, buffer_h);
+			return NULL;
 		}
+		mmalsrc->pair_unmatched = 0;
+	}
+	mmalsrc->last_frame = dequeue;
+
+	gst_mmalsrc_pool_check(mmalsrc);
+	gst_mmalsrc_preroll_keep(mmalsrc, buffer_h, dequeue);
+
+	// Bursts bypass decimation and change detection
+	mmalsrc->burst_frame = gst_mmalsrc_burst_check(mmalsrc);
+	if (mmalsrc->burst_frame) {
+		*keep = TRUE;
+	} else if (!gst_mmalsrc_decimate_check(mmalsrc)) {
+		gst_mmalsrc_pair_recycle(mmalsrc, buffer_h, *buffer2_h);
+		return NULL;
+	} else {
+		*keep = !gate || gst_mmalsrc_motion_check(mmalsrc, buffer_h);
 	}
 
-	/************** ENABLE CONTROL PORT **************/
-	status = mmal_port_enable(camera->control, control_bh_cb);
-
-	if (status != MMAL_SUCCESS) {
-		GST_ERROR("Unable to enable control port : error %d", status);
-		goto error;
+	// Static or held frame : only its copy in the pre-event ring, the
+	// headers go back to the cameras right away
+	if ((!*keep && drop) || gst_mmalsrc_preroll_hold(mmalsrc)) {
+		gst_mmalsrc_pair_recycle(mmalsrc, buffer_h, *buffer2_h);
+		return NULL;
 	}
 
-	GST_INFO("control port enabled");
+	return buffer_h;
+}
 
-	/************** ENABLE CAMERA COMPONENT **************/
-	status = mmal_component_enable(camera);
-	if (status) {
-		GST_ERROR("%s: camera component couldn't be enabled", __func__);
-		goto error;
-	}
+/*******************************************************************
+ * gst_mmalsrc_stamp_clock
+ *
+ * Take the offset between the running time and the monotonic clock,
+ * once per frame dequeued by create, so that frames kept in the
+ * pre-event ring during a long hold are stamped with a fresh offset.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_stamp_clock(GstMMALSrc *mmalsrc) {
+	GstClock *clock = gst_element_get_clock(GST_ELEMENT(mmalsrc));
 
-	mmalsrc->camera_component = camera;
+	mmalsrc->stamp_clock_valid = clock != NULL;
+	if (!clock)
+		return;
 
-	GST_INFO("%s: camera component created", __func__);
+	mmalsrc->stamp_clock = (gint64) gst_clock_get_time(clock)
+			- (gint64) gst_element_get_base_time(GST_ELEMENT(mmalsrc))
+			- g_get_monotonic_time() * (gint64) GST_USECOND;
+	gst_object_unref(clock);
+}
 
-	return ret;
+/*******************************************************************
+ * gst_mmalsrc_stamp_buffer
+ *
+ * Timestamp a buffer with the running time of its frame : the time it
+ * was caught by the port callback, or dequeued. The same source with
+ * or without latency-tracing, which only reads the sensor time.
+ *
+ ******************************************************************/
+static void gst_mmalsrc_stamp_buffer(GstMMALSrc *mmalsrc, GstBuffer *buf,
+		gint64 caught) {
+	gint64 running;
+	gint num, den;
 
-error:
-	if (camera)
-		mmal_component_destroy(camera);
+	if (!mmalsrc->stamp_clock_valid)
+		return;
 
-	GST_ERROR("%s: Failed to create camera component", __func__);
-	ret = FALSE;
-	return ret;
+	running = mmalsrc->stamp_clock + caught * (gint64) GST_USECOND;
+	GST_BUFFER_PTS(buf) = MAX(running, 0);
+
+	// Decimated frames last until the next pushed one
+	if (mmalsrc->burst_frame || !gst_mmalsrc_output_rate(mmalsrc, &num, &den)) {
+		num = mmalsrc->framerate.num;
+		den = mmalsrc->framerate.den;
+	}
+	if (num > 0)
+		GST_BUFFER_DURATION(buf) = gst_util_uint64_scale_int(GST_SECOND, den,
+				num);
 }
 
 /*******************************************************************
- * gst_mmalsrc_stop
+ * gst_mmalsrc_preroll_keep
+ *
+ * Copy a frame in the pre-event ring, stamped as it is when pushed.
+ * The header stays with the caller.
  *
  ******************************************************************/
-static gboolean gst_mmalsrc_stop(GstBaseSrc * src) {
-	GstMMALSrc *mmalsrc = GST_MMALSRC(src);
-	gboolean ret = TRUE;
+static void gst_mmalsrc_preroll_keep(GstMMALSrc *mmalsrc,
+		MMAL_BUFFER_HEADER_T *buffer_h, gint64 dequeue) {
+	GstMMALSrcHeaderInfo *info = (GstMMALSrcHeaderInfo *) buffer_h->user_data;
+	GstBuffer *buf;
+
+	if (!mmalsrc->preroll_arena)
+		return;
+
+	// Subsampled mode : one frame every preroll-subsample
+	if (mmalsrc->preroll_skip) {
+		mmalsrc->preroll_skip--;
+		return;
+	}
+	mmalsrc->preroll_skip = mmalsrc->preroll_subsample - 1;
 
-	GST_INFO("stop function");
-	vcos_event_flags_delete(&events);
-	destroy_camera_component(mmalsrc);
+	if (mmalsrc->raw && mmalsrc->raw_out_bits)
+		buf = gst_mmalsrc_unpack_frame(mmalsrc, buffer_h);
+	else
+		buf = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,
+				buffer_h->data, mmalsrc->cam_port->buffer_size, 0,
+				mmalsrc->cam_port->buffer_size, NULL, NULL);
+	if (!buf)
+		return;
+
+	gst_mmalsrc_stamp_buffer(mmalsrc, buf,
+			info && info->callback ? info->callback : dequeue);
+	gst_mmalsrc_preroll_store(mmalsrc, buf);
+	gst_buffer_unref(buf);
+}
 
-	mmal_queue_destroy(mmalsrc->queue_video_frames);
-	mmal_pool_destroy(mmalsrc->cam_pool);
+/*******************************************************************
+ * gst_mmalsrc_frame_wrap
+ *
+ * Wrap a selected frame in a GstBuffer, flagged and stamped. dequeue
+ * is the time the frame left the queue.
+ *
+ ******************************************************************/
+static GstBuffer *gst_mmalsrc_frame_wrap(GstMMALSrc *mmalsrc,
+		MMAL_BUFFER_HEADER_T *buffer_h, MMAL_BUFFER_HEADER_T *buffer2_h,
+		gboolean keep, gint64 dequeue) {
+	GstMMALSrcHeaderInfo *info = (GstMMALSrcHeaderInfo *) buffer_h->user_data;
+	gint64 pts = buffer_h->pts;
+	gint64 callback = info ? info->callback : 0;
+	GstBuffer *buf;
+
+	if (mmalsrc->raw && mmalsrc->raw_out_bits) {
+		// Unpacked copy, the header goes straight back to the camera
+		buf = gst_mmalsrc_unpack_frame(mmalsrc, buffer_h);
+		gst_mmalsrc_recycle_buffer(mmalsrc, buffer_h);
+		info = NULL;
+	} else if (buffer2_h) {
+		buf = gst_mmalsrc_pair_wrap(mmalsrc, buffer_h, buffer2_h);
+	} else {
+		buf = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,
+				buffer_h->data, mmalsrc->cam_port->buffer_size, 0,
+				mmalsrc->cam_port->buffer_size, buffer_h,
+				(GDestroyNotify) gst_release_buffer_cb);
+	}
 
-	return ret;
+	if (!buf)
+		return NULL;
+
+	// Pyramid built while the frame is still in the MMAL header
+	if (mmalsrc->pyramid_pool)
+		gst_mmalsrc_pyramid_attach(mmalsrc, buf, buffer_h);
+
+	// Wrapped header held downstream, view 0 only for a pair
+	if (info) {
+		info->pushed = g_get_monotonic_time();
+		g_atomic_int_inc(&mmalsrc->outstanding);
+	}
+
+	if (!keep)
+		GST_BUFFER_FLAG_SET(buf, GST_BUFFER_FLAG_DROPPABLE);
+
+	// First frame after a camera restart
+	if (mmalsrc->discont) {
+		GST_BUFFER_FLAG_SET(buf, GST_BUFFER_FLAG_DISCONT);
+		mmalsrc->discont = FALSE;
+	}
+
+	gst_mmalsrc_stamp_buffer(mmalsrc, buf, callback ? callback : dequeue);
+	if (GST_BUFFER_PTS_IS_VALID(buf))
+		mmalsrc->pushed_end = GST_BUFFER_PTS(buf)
+				+ (GST_BUFFER_DURATION_IS_VALID(buf) ?
+						GST_BUFFER_DURATION(buf) : 0);
+
+	if (mmalsrc->tracing)
+		gst_mmalsrc_latency_stamp(mmalsrc, buf, pts, callback, dequeue);
+
+	return buf;
 }
 
+#if GST_CHECK_VERSION(1,14,0)
 /*******************************************************************
- * gst_release_buffer_cb
+ * gst_mmalsrc_batch_push
  *
- * Buffer release when GStreamer is done using it.
+ * Add *buf to a new list, then the frames already waiting and those
+ * coming up to batch-latency ms after first, up to batch-size frames.
+ * The list is submitted to the base class, that pushes it once create
+ * returns.
  *
  ******************************************************************/
-static void gst_release_buffer_cb(gpointer data) {
+static GstFlowReturn gst_mmalsrc_batch_push(GstMMALSrc *mmalsrc,
+		GstBuffer **buf, gint64 first, gboolean gate, gboolean drop) {
+	gint64 deadline = first
+			+ mmalsrc->batch_latency * G_TIME_SPAN_MILLISECOND;
+	MMAL_BUFFER_HEADER_T *buffer_h, *buffer2_h;
+	GstBufferList *list = gst_buffer_list_new_sized(mmalsrc->batch_size);
+	guint frames = 1;
+	gboolean keep;
+	gint64 now, dequeue;
+	GstBuffer *next;
+
+	gst_buffer_list_add(list, *buf);
+	*buf = NULL;
+
+	while (frames < mmalsrc->batch_size && !mmalsrc->unlock
+			&& !mmalsrc->port_failed) {
+		gst_mmalsrc_send_empty_buffers(mmalsrc);
+
+		now = g_get_monotonic_time();
+		buffer_h = gst_mmalsrc_wait_frame(mmalsrc,
+				now < deadline ? (deadline - now + 999) / 1000 : 0);
+		if (!buffer_h)
+			break;
 
-	MMAL_BUFFER_HEADER_T *d = (MMAL_BUFFER_HEADER_T *) data;
-	mmal_buffer_header_release(d);
+		dequeue = g_get_monotonic_time();
+		if (mmalsrc->raw)
+			gst_mmalsrc_raw_trigger(mmalsrc);
+
+		buffer_h = gst_mmalsrc_frame_select(mmalsrc, buffer_h, &buffer2_h,
+				&keep, gate, drop, dequeue);
+		if (!buffer_h)
+			continue;
+
+		next = gst_mmalsrc_frame_wrap(mmalsrc, buffer_h, buffer2_h, keep,
+				dequeue);
+		if (next) {
+			gst_buffer_list_add(list, next);
+			frames++;
+		}
+	}
 
+	GST_LOG("submitting a list of %u buffers", frames);
+	gst_base_src_submit_buffer_list(GST_BASE_SRC(mmalsrc), list);
+	return GST_FLOW_OK;
 }
+#endif
 
 /*******************************************************************
  * gst_mmalsrc_create
  *
- * Give a buffer to GStreamer containing the image.
+ * Give a buffer to GStreamer containing the image, or a list of them
+ * when batching or flushing the pre-event ring.
  * Also sets the port format once when the stream starts.
  *
  ******************************************************************/
@@ -612,9 +4251,11 @@ static GstFlowReturn gst_mmalsrc_create(GstPushSrc *src, GstBuffer **buf) {
 	GstFlowReturn ret;
 
 	MMAL_BUFFER_HEADER_T *buffer_h = NULL;
-	MMAL_STATUS_T status = MMAL_SUCCESS;
+	MMAL_BUFFER_HEADER_T *buffer2_h = NULL;
 	VCOS_UNSIGNED set;
-	MMAL_ES_FORMAT_T *format;
+	GstMMALSrcMotionGate motion_gate;
+	gboolean gate, drop, keep = TRUE;
+	gint64 dequeue = 0;
 
 	/* Not Implemented */
 	ret = GST_FLOW_ERROR;
@@ -628,120 +4269,97 @@ static GstFlowReturn gst_mmalsrc_create(GstPushSrc *src, GstBuffer **buf) {
 	}
 
 	if (!mmalsrc->first_port_config) {
-		/************** CAMERA PORT **************/
-		/* Set up the port format */
-		format = mmalsrc->cam_port->format;
-
-		format->type = MMAL_ES_TYPE_VIDEO;
-		format->encoding = mmalsrc->encoding;
-		format->es->video.width = mmalsrc->width;
-		format->es->video.height = mmalsrc->height;
-		format->es->video.crop.x = 0;
-		format->es->video.crop.y = 0;
-		format->es->video.crop.width = mmalsrc->width;
-		format->es->video.crop.height = mmalsrc->height;
-		format->es->video.frame_rate.num = mmalsrc->framerate.num;
-		format->es->video.frame_rate.den = mmalsrc->framerate.den;
-		format->es->video.par.num = MMALSRC_PAR_NUM;
-		format->es->video.par.den = MMALSRC_PAR_DEN;
-
-		status = mmal_port_format_commit(mmalsrc->cam_port);
-		if (status != MMAL_SUCCESS) {
-			GST_ERROR("camera output port format couldn't be set");
-			return ret;
-		}
-
-		/* set port size */
-		mmalsrc->cam_port->buffer_size =
-				mmalsrc->cam_port->buffer_size_recommended;
-		mmalsrc->cam_port->buffer_num = MMALSRC_FRMBUF_COUNT;
-
-		if (mmalsrc->cam_port->buffer_size
-				< mmalsrc->cam_port->buffer_size_min)
-			mmalsrc->cam_port->buffer_size =
-					mmalsrc->cam_port->buffer_size_min;
-
-		if (mmalsrc->cam_port->buffer_num
-				< mmalsrc->cam_port->buffer_num_min)
-			mmalsrc->cam_port->buffer_num =
-					mmalsrc->cam_port->buffer_num_min;
-
-		/* Create pool of buffer headers for the output port to consume */
-		mmalsrc->cam_pool = mmal_port_pool_create(mmalsrc->cam_port,
-				mmalsrc->cam_port->buffer_num,
-				mmalsrc->cam_port->buffer_size);
-
-		if (!mmalsrc->cam_pool) {
-			GST_ERROR("failed to create pool for %s",
-					mmalsrc->cam_port->name);
+		if (!gst_mmalsrc_port_setup(mmalsrc))
 			return ret;
-		}
 
-		/* Display buffer information */
-		GST_INFO("%s: buffer size recommended %d", __func__,
-				mmalsrc->cam_port->buffer_size_recommended);
-		GST_INFO("%s: buffer size: %d", __func__,
-				mmalsrc->cam_port->buffer_size);
+		mmalsrc->first_port_config = 1;
+	}
 
-		GST_INFO("%s: buffer num recommended : %d", __func__,
-				mmalsrc->cam_port->buffer_num_recommended);
-		GST_INFO("%s: buffer num min : %d", __func__,
-				mmalsrc->cam_port->buffer_num_min);
-		GST_INFO("%s: buffer num : %d", __func__,
-				mmalsrc->cam_port->buffer_num);
+	/* Read once, the property may change from another thread */
+	motion_gate = mmalsrc->motion_gate;
+	gate = motion_gate != MMALSRC_MOTION_GATE_OFF;
+	drop = motion_gate == MMALSRC_MOTION_GATE_DROP;
 
-		// Create a queue to store our video frames. The callback we will get when
-		// a frame has been decoded will put the frame into this queue.
+	if (!mmalsrc->streaming_thread_ready)
+		gst_mmalsrc_streaming_setup(mmalsrc);
 
-		mmalsrc->queue_video_frames = mmal_queue_create();
+	do {
+		// Frames of a pre-event flush go first, one per call
+		if (gst_mmalsrc_preroll_next(mmalsrc, buf))
+			return GST_FLOW_OK;
 
-		if (!mmalsrc->queue_video_frames) {
-			GST_ERROR("failed to create queue video frames");
-			return ret;
+		if (!mmalsrc->use_ring) {
+			/* Set VideoCore event communication */
+			vcos_event_flags_get(&events, MMAL_CAM_ANY_EVENT, VCOS_OR_CONSUME,
+					VCOS_TICKS_TO_MS(2), &set);
 		}
-		mmalsrc->cam_port->userdata =
-				(void *) mmalsrc->queue_video_frames;
 
-		/* Enable port with callback */
-		status = mmal_port_enable(mmalsrc->cam_port, generic_output_port_cb);
-		if (status != MMAL_SUCCESS) {
-			GST_ERROR("failed to enable %s", mmalsrc->cam_port->name);
-			return ret;
+		// Send empty buffers to the output port of the video to allow the video to start
+		// producing frames as soon as it gets input data
+		gst_mmalsrc_send_empty_buffers(mmalsrc);
+
+		// Waiting for a ready buffer
+		buffer_h = gst_mmalsrc_wait_frame(mmalsrc, MMALSRC_WAIT_SLICE_MS);
+		if (!buffer_h) {
+			gint64 stall = g_get_monotonic_time() - mmalsrc->last_frame;
+
+			if (mmalsrc->unlock)
+				break;
+			if (mmalsrc->watchdog_frames
+					&& stall > gst_mmalsrc_watchdog_timeout(mmalsrc)
+					&& !gst_mmalsrc_recover(mmalsrc, stall))
+				return GST_FLOW_ERROR;
+			continue;
 		}
-		GST_INFO("camera port enabled with output callback");
-
-		mmalsrc->first_port_config = 1;
-	}
-
-	/* Set VideoCore event communication */
-	vcos_event_flags_get(&events, MMAL_CAM_ANY_EVENT, VCOS_OR_CONSUME,
-			VCOS_TICKS_TO_MS(2), &set);
 
-	// Send empty buffers to the output port of the video to allow the video to start
-	// producing frames as soon as it gets input data
-	while ((buffer_h = mmal_queue_get(mmalsrc->cam_pool->queue)) != NULL) {
-		status = mmal_port_send_buffer(mmalsrc->cam_port, buffer_h);
-		if (status != MMAL_SUCCESS) {
-			GST_INFO("Error when sending EMPTY buffer to camera port");
-		}
+		dequeue = g_get_monotonic_time();
+		gst_mmalsrc_stamp_clock(mmalsrc);
+		mmalsrc->frame_seen = TRUE;
+		if (mmalsrc->raw)
+			gst_mmalsrc_raw_trigger(mmalsrc);
+		if (mmalsrc->recovery_start)
+			gst_mmalsrc_recovery_post(mmalsrc);
+
+		buffer_h = gst_mmalsrc_frame_select(mmalsrc, buffer_h, &buffer2_h,
+				&keep, gate, drop, dequeue);
+	} while (!buffer_h && !mmalsrc->unlock && !mmalsrc->port_failed);
+
+	if (mmalsrc->port_failed) {
+		if (buffer_h)
+			gst_mmalsrc_pair_recycle(mmalsrc, buffer_h, buffer2_h);
+		return GST_FLOW_ERROR;
 	}
 
-	// Waiting for a ready buffer
-	buffer_h = mmal_queue_wait(mmalsrc->queue_video_frames);
+	if (!buffer_h && mmalsrc->unlock)
+		return GST_FLOW_FLUSHING;
 
 	// Wrap the buffer in the output GstBuffer
 	if (buffer_h) {
 
-		*buf = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,
-				buffer_h->data, mmalsrc->cam_port->buffer_size, 0,
-				mmalsrc->cam_port->buffer_size, buffer_h,
-				(GDestroyNotify) gst_release_buffer_cb);
+		// First live frame after a pre-event flush
+		if (mmalsrc->preroll_resume)
+			mmalsrc->discont = TRUE;
 
-		if (!buf) {
+		*buf = gst_mmalsrc_frame_wrap(mmalsrc, buffer_h, buffer2_h, keep,
+				dequeue);
+
+		if (!*buf) {
 			GST_ERROR("buffer already used");
 			return ret;
 		}
 
+		if (mmalsrc->preroll_resume) {
+			gst_mini_object_set_qdata(GST_MINI_OBJECT(*buf), preroll_quark,
+					GINT_TO_POINTER(MMALSRC_PREROLL_RESUME), NULL);
+			mmalsrc->preroll_resume = FALSE;
+		}
+
+#if GST_CHECK_VERSION(1,14,0)
+		// High frame rates : one push for many frames
+		if (mmalsrc->batching)
+			return gst_mmalsrc_batch_push(mmalsrc, buf, dequeue, gate, drop);
+#endif
+
 		// everything's OK !
 		ret = GST_FLOW_OK;
 	} else {
@@ -759,6 +4377,8 @@ static GstFlowReturn gst_mmalsrc_create(GstPushSrc *src, GstBuffer **buf) {
 static gboolean gst_mmalsrc_unlock(GstBaseSrc * src) {
 	GstMMALSrc *mmalsrc = GST_MMALSRC(src);
 	mmalsrc->unlock = true;
+	if (mmalsrc->use_ring)
+		gst_mmalsrc_ring_wakeup(mmalsrc);
 	return true;
 }
 
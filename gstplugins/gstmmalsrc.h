@@ -11,6 +11,8 @@
 #define _GST_MMALSRC_H_
 
 #include <gst/base/gstpushsrc.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "interface/mmal/mmal.h"
 #include "interface/mmal/mmal_logging.h"
@@ -20,6 +22,8 @@
 #include "interface/mmal/util/mmal_default_components.h"
 #include "interface/mmal/util/mmal_connection.h"
 
+#include "gstmmalpyramid.h"
+
 
 G_BEGIN_DECLS
 
@@ -49,6 +53,21 @@ G_BEGIN_DECLS
 /* Number of requested buffers, need at least 2 buffers */
 #define MMALSRC_FRMBUF_COUNT 6
 
+/* Elastic camera pool, off by default. The size starts at
+ * MMALSRC_FRMBUF_COUNT, the port is reconfigured on each change */
+#define MMALSRC_DEFAULT_POOL_ADAPTIVE FALSE
+#define MMALSRC_DEFAULT_POOL_MIN 3
+#define MMALSRC_DEFAULT_POOL_MAX 12
+#define MMALSRC_MAX_POOL_SIZE 32
+/* Memory cap of the pool payloads in bytes, 0 for no cap */
+#define MMALSRC_DEFAULT_POOL_MEMORY_BUDGET 0
+/* Frames between two sizing decisions */
+#define MMALSRC_POOL_WINDOW 60
+/* Headers on top of the downstream need : the one filled, the one queued */
+#define MMALSRC_POOL_HEADROOM 2
+/* Consecutive windows asking for fewer headers before one is released */
+#define MMALSRC_POOL_SHRINK_WINDOWS 3
+
 /* Video format */
 #define MMALSRC_DEFAULT_FORMAT "RGBA"
 
@@ -59,6 +78,113 @@ G_BEGIN_DECLS
 #define MMALSRC_PAR_NUM 1
 #define MMALSRC_PAR_DEN 1
 
+/* Change detection gating */
+typedef enum
+{
+    MMALSRC_MOTION_GATE_OFF,   /* push every frame */
+    MMALSRC_MOTION_GATE_DROP,  /* recycle static frames at the source */
+    MMALSRC_MOTION_GATE_TAG    /* push every frame, flag static ones */
+} GstMMALSrcMotionGate;
+#define MMALSRC_DEFAULT_MOTION_GATE MMALSRC_MOTION_GATE_OFF
+/* Mean absolute luma difference (0-255) below which a frame is static */
+#define MMALSRC_DEFAULT_MOTION_THRESHOLD 4
+/* Push one static frame every N frames, 0 to disable */
+#define MMALSRC_DEFAULT_MOTION_HEARTBEAT 30
+/* Consecutive static frames needed before gating starts */
+#define MMALSRC_DEFAULT_MOTION_HYSTERESIS 5
+/* Downsampled luma grid used for the frame difference */
+#define MMALSRC_MOTION_GRID_WIDTH 32
+#define MMALSRC_MOTION_GRID_HEIGHT 18
+
+/* Output rate, 0/1 to push every frame at the sensor rate */
+#define MMALSRC_DEFAULT_OUTPUT_RATE_NUM 0
+#define MMALSRC_DEFAULT_OUTPUT_RATE_DEN 1
+/* Sensor rate when an output rate is negotiated in the caps */
+#define MMALSRC_DEFAULT_SENSOR_RATE_NUM MMALSRC_DEFAULT_FRAMERATE_NUM
+#define MMALSRC_DEFAULT_SENSOR_RATE_DEN MMALSRC_DEFAULT_FRAMERATE_DEN
+/* Highest framerate of the template caps, fps */
+#define MMALSRC_MAX_SENSOR_RATE 90
+/* Bursts make the output rate variable, caps then have framerate 0/1 */
+#define MMALSRC_DEFAULT_ALLOW_BURST FALSE
+
+/* Frame hand-off between the MMAL callback and the streaming thread */
+#define MMALSRC_CAPTURE_MODE_QUEUE "queue" /* MMAL queue and VCOS event */
+#define MMALSRC_CAPTURE_MODE_RING "ring"   /* lock-free ring and eventfd */
+#define MMALSRC_DEFAULT_CAPTURE_MODE MMALSRC_CAPTURE_MODE_QUEUE
+/* Thread tuning, -1 for no CPU pinning, 0 for no SCHED_FIFO */
+#define MMALSRC_DEFAULT_THREAD_CPU -1
+#define MMALSRC_DEFAULT_THREAD_PRIORITY 0
+/* Ring slots, power of two and at least the pool size */
+#define MMALSRC_RING_SIZE 64
+
+/* Raw Bayer capture */
+#define MMALSRC_DEFAULT_BAYER_FORMAT "bggr16le"
+/* Sensor packing for unpacked formats, 10 or 12 bits */
+#define MMALSRC_DEFAULT_BAYER_BITS 10
+/* Right shift for 8-bit output, -1 to keep the 8 MSBs */
+#define MMALSRC_DEFAULT_BAYER_SHIFT -1
+/* Threads unpacking a frame, the streaming thread included */
+#define MMALSRC_DEFAULT_BAYER_THREADS 1
+#define MMALSRC_MAX_BAYER_THREADS 8
+
+/* Latency tracing */
+#define MMALSRC_LATENCY_TRACING_OFF "off"
+#define MMALSRC_LATENCY_TRACING_ON "on"
+#define MMALSRC_DEFAULT_LATENCY_TRACING MMALSRC_LATENCY_TRACING_OFF
+/* Frames between two latency reports, 0 to disable reports */
+#define MMALSRC_DEFAULT_LATENCY_REPORT 300
+/* Histogram bucket i counts latencies below 2^i microseconds */
+#define MMALSRC_LATENCY_BUCKETS 24
+
+/* Stall watchdog, frame periods without a frame before the camera is
+ * restarted, 0 to disable */
+#define MMALSRC_DEFAULT_WATCHDOG_FRAMES 0
+/* Shortest stall, and stall allowed before the first frame, in ms */
+#define MMALSRC_WATCHDOG_MIN_MS 500
+#define MMALSRC_WATCHDOG_STARTUP_MS 3000
+/* Longest single wait for a frame, in ms */
+#define MMALSRC_WAIT_SLICE_MS 100
+
+/* Stereo capture */
+#define MMALSRC_STEREO_MODE_OFF "off"
+#define MMALSRC_STEREO_MODE_SIDE_BY_SIDE "side-by-side" /* firmware, one frame */
+#define MMALSRC_STEREO_MODE_TOP_BOTTOM "top-bottom"     /* firmware, one frame */
+#define MMALSRC_STEREO_MODE_PAIR "pair"   /* two cameras paired by timestamp */
+#define MMALSRC_DEFAULT_STEREO_MODE MMALSRC_STEREO_MODE_OFF
+/* Largest timestamp difference of a pair, in microseconds */
+#define MMALSRC_DEFAULT_STEREO_TOLERANCE 5000
+/* Camera paired with camera 0 */
+#define MMALSRC_STEREO_SECOND_CAMERA 1
+/* Wait for the second frame on top of the tolerance, in ms */
+#define MMALSRC_STEREO_WAIT_MARGIN_MS 10
+/* Consecutive frames of camera 0 without a pair before a warning */
+#define MMALSRC_STEREO_UNMATCHED_WARNING 30
+
+/* Batched push, frames per buffer list, 1 to push frames one by one */
+#define MMALSRC_DEFAULT_BATCH_SIZE 1
+#define MMALSRC_MAX_BATCH_SIZE MMALSRC_MAX_POOL_SIZE
+/* Wait for more frames after the first one of a list, in ms */
+#define MMALSRC_DEFAULT_BATCH_LATENCY 0
+#define MMALSRC_MAX_BATCH_LATENCY MMALSRC_WAIT_SLICE_MS
+
+/* Luma pyramid, levels at 1/2, 1/4 and 1/8 scale, 0 for no pyramid */
+#define MMALSRC_DEFAULT_PYRAMID_LEVELS 0
+typedef enum
+{
+    MMALSRC_PYRAMID_FILTER_BOX = MMAL_PYRAMID_FILTER_BOX,        /* mean of 2x2 blocks */
+    MMALSRC_PYRAMID_FILTER_NEAREST = MMAL_PYRAMID_FILTER_NEAREST /* one sample per 2x2 block */
+} GstMMALSrcPyramidFilter;
+#define MMALSRC_DEFAULT_PYRAMID_FILTER MMALSRC_PYRAMID_FILTER_BOX
+
+/* Pre-event ring, frames kept in ms, 0 for no ring */
+#define MMALSRC_DEFAULT_PREROLL_DURATION 0
+/* Memory cap of the ring arena in bytes */
+#define MMALSRC_DEFAULT_PREROLL_MEMORY (64 * 1024 * 1024)
+/* Keep one frame every N in the ring */
+#define MMALSRC_DEFAULT_PREROLL_SUBSAMPLE 1
+/* Keep live frames in the ring rather than pushing them until a flush */
+#define MMALSRC_DEFAULT_PREROLL_HOLD FALSE
+
 /* Standard port setting for the camera component */
 #define MMAL_CAMERA_PREVIEW_PORT 0
 #define MMAL_CAMERA_VIDEO_PORT 1
@@ -66,6 +192,59 @@ G_BEGIN_DECLS
 
 typedef struct _GstMMALSrc GstMMALSrc;
 typedef struct _GstMMALSrcClass GstMMALSrcClass;
+typedef struct _GstMMALSrcRetiredPool GstMMALSrcRetiredPool;
+
+/* Latency stages, between two timestamps of GstMMALSrcLatencyMeta */
+typedef enum
+{
+    MMALSRC_LATENCY_SENSOR_TO_CALLBACK,
+    MMALSRC_LATENCY_CALLBACK_TO_DEQUEUE,
+    MMALSRC_LATENCY_DEQUEUE_TO_PUSH,
+    MMALSRC_LATENCY_SENSOR_TO_PUSH,
+    MMALSRC_LATENCY_STAGES
+} GstMMALSrcLatencyStageId;
+
+/* Latency histogram, only written and read by the streaming thread */
+typedef struct
+{
+    guint buckets[MMALSRC_LATENCY_BUCKETS];
+    guint count;
+    gint64 sum;
+    gint64 min;
+    gint64 max;
+} GstMMALSrcLatencyStage;
+
+/* Per-header bookkeeping, pointed to by the MMAL header user_data */
+typedef struct
+{
+    GstMMALSrc *mmalsrc;
+    gint64 callback;           /* port callback time, stamped on every frame */
+    gint64 pushed;             /* time the frame was pushed downstream */
+    GstMMALSrcRetiredPool *retired; /* its pool, once the port is torn down */
+} GstMMALSrcHeaderInfo;
+
+/* Header added on top of cam_pool, in a pool of its own */
+typedef struct
+{
+    MMAL_POOL_T *pool;         /* NULL once destroyed */
+    GstMMALSrcHeaderInfo info;
+} GstMMALSrcExtraHeader;
+
+/* Frame copied in a slot of the pre-event arena */
+typedef struct
+{
+    GstClockTime pts;
+    GstClockTime duration;
+    gsize size;                /* bytes used in the slot */
+} GstMMALSrcPrerollSlot;
+
+/* Lock-free single producer / single consumer ring of frames */
+typedef struct
+{
+    MMAL_BUFFER_HEADER_T *slots[MMALSRC_RING_SIZE];
+    volatile gint head;        /* next slot written by the port callback */
+    volatile gint tail;        /* next slot read by the streaming thread */
+} GstMMALSrcRing;
 
 
 struct _GstMMALSrc
@@ -77,6 +256,41 @@ struct _GstMMALSrc
     guint shutter_period;      /* shutter period in microseconds */
     guint iso;                 /* ISO sensitivity value */
     gchar* exposure;           /* camera exposure mechanism on/off */
+    GstMMALSrcMotionGate motion_gate; /* change detection gating */
+    guint motion_threshold;    /* static frame threshold on luma difference */
+    guint motion_heartbeat;    /* static frames between two heartbeats */
+    guint motion_hysteresis;   /* static frames before gating starts */
+    gint output_rate_num;      /* pushed frame rate, 0 for sensor rate */
+    gint output_rate_den;
+    gint sensor_rate_num;      /* sensor rate when decimating */
+    gint sensor_rate_den;
+    gboolean allow_burst;      /* burst signal honoured, variable rate caps */
+    gchar* capture_mode;       /* frame hand-off, queue or ring */
+    gint capture_cpu;          /* CPU of the capture thread */
+    guint capture_priority;    /* SCHED_FIFO priority of the capture thread */
+    gint streaming_cpu;        /* CPU of the streaming thread */
+    guint streaming_priority;  /* SCHED_FIFO priority of the streaming thread */
+    guint bayer_bits;          /* sensor packing, 10 or 12 bits */
+    gint bayer_shift;          /* right shift for 8-bit Bayer output */
+    guint bayer_threads;       /* threads unpacking raw frames */
+    gchar* latency_tracing;    /* per-stage timestamps on/off */
+    guint latency_report;      /* frames between two latency reports */
+    gboolean pool_adaptive;    /* pool sized from the downstream hold time */
+    guint pool_min;            /* fewest camera headers */
+    guint pool_max;            /* most camera headers */
+    guint64 pool_memory_budget; /* cap of the header payloads in bytes */
+    guint pool_size;           /* camera headers in use, read-only */
+    guint watchdog_frames;     /* frame periods before a stall restart */
+    gchar* stereo_mode;        /* off, side-by-side, top-bottom or pair */
+    guint stereo_tolerance;    /* largest pts difference of a pair, us */
+    guint batch_size;          /* most buffers pushed in one list */
+    guint batch_latency;       /* wait for more frames of a list, ms */
+    guint pyramid_levels;      /* downscaled luma levels attached, 0 for none */
+    GstMMALSrcPyramidFilter pyramid_filter; /* downscale filter */
+    guint preroll_duration;    /* frames kept before an event, ms */
+    guint64 preroll_memory;    /* cap of the pre-event arena in bytes */
+    guint preroll_subsample;   /* one frame kept every preroll_subsample */
+    gboolean preroll_hold;     /* live frames held in the ring until a flush */
 
     /* Plugin variables */
     guint first_port_config;
@@ -85,6 +299,19 @@ struct _GstMMALSrc
     MMAL_RATIONAL_T framerate;
     MMAL_RATIONAL_T par;
     MMAL_FOURCC_T encoding;
+    GstVideoInfo frame_info;   /* plane layout of the camera frames */
+
+    /* Raw Bayer capture */
+    gboolean raw;              /* video/x-bayer negotiated */
+    guint raw_bits;            /* packed sample size, 10 or 12 */
+    guint raw_out_bits;        /* 8 or 16 when unpacking, 0 for packed output */
+    guint raw_shift;           /* right shift for 8-bit output */
+    guint raw_stride;          /* bytes per packed line */
+    guint raw_out_stride;      /* bytes per unpacked line */
+    GThreadPool *unpack_pool;
+    GMutex unpack_lock;
+    GCond unpack_cond;
+    guint unpack_pending;      /* slices not unpacked yet */
     //const gchar * pixel_format;
 
     /* MMAL camera structures */
@@ -93,6 +320,113 @@ struct _GstMMALSrc
     MMAL_PORT_T *cam_port; // output port
     MMAL_QUEUE_T *queue_video_frames; // pointer queue to image buffers
 
+    /* Elastic pool */
+    GstMMALSrcHeaderInfo *pool_info; /* info of the cam_pool headers */
+    GstMMALSrcExtraHeader extra[MMALSRC_MAX_POOL_SIZE];
+    guint extra_active;        /* extra headers given to the camera */
+    guint extra_allocated;     /* extra headers alive, retiring ones included */
+    guint pool_limit;          /* most headers allowed by pool-max and budget */
+    volatile gint outstanding; /* headers held downstream */
+    volatile gint hold_sum;    /* downstream hold time over the window, us */
+    volatile gint hold_count;  /* headers released over the window */
+    guint pool_peak;           /* most headers held over the window */
+    guint pool_dry;            /* frames dequeued without a spare header */
+    guint pool_frames;         /* frames since the last sizing */
+    guint pool_shrink;         /* consecutive windows asking for less */
+    GSList *retired_pools;     /* pools of a torn down port, until back home */
+    gboolean port_failed;      /* the port couldn't be enabled again */
+
+    /* Stall watchdog */
+    gint64 last_frame;         /* monotonic time of the last frame, or pair */
+    gboolean frame_seen;       /* a frame came since the port was set up */
+    gint64 recovery_start;     /* stall start, 0 when not recovering */
+    guint recoveries;          /* camera restarts */
+    gboolean discont;          /* flag the next pushed buffer DISCONT */
+
+    /* Stereo capture */
+    MMAL_STEREOSCOPIC_MODE_T stereo; /* firmware stereo layout */
+    gboolean stereo_pair;      /* frames of a second camera paired by pts */
+    MMAL_COMPONENT_T *camera2_component;
+    MMAL_PORT_T *cam2_port;
+    MMAL_POOL_T *cam2_pool;
+    MMAL_QUEUE_T *queue_pair_frames; /* frames of the second camera */
+    MMAL_BUFFER_HEADER_T *pair_pending; /* second frame newer than the first */
+    guint pair_unmatched;      /* first frames dropped since the last pair */
+
+    /* Luma pyramid */
+    GstBufferPool *pyramid_pool; /* buffers holding every level of a frame */
+    guint pyramid_width[MMAL_PYRAMID_MAX_LEVELS];
+    guint pyramid_height[MMAL_PYRAMID_MAX_LEVELS];
+    guint pyramid_stride[MMAL_PYRAMID_MAX_LEVELS];
+    gsize pyramid_offset[MMAL_PYRAMID_MAX_LEVELS];
+
+    /* Batched push */
+    gboolean batching;         /* frames pushed in buffer lists */
+
+    /* Buffer timestamps set by the element */
+    gint64 stamp_clock;        /* running time minus monotonic time, ns */
+    gboolean stamp_clock_valid;
+
+    /* Pre-event ring */
+    guint8 *preroll_arena;     /* preroll_count slots of preroll_slot_size */
+    GstMMALSrcPrerollSlot *preroll_slots;
+    guint preroll_count;
+    gsize preroll_slot_size;
+    guint preroll_head;        /* next slot written */
+    guint preroll_fill;        /* slots holding a frame */
+    guint preroll_skip;        /* frames to skip before the next copy */
+    volatile gint preroll_flush; /* flush requested by the action signal */
+    volatile gint preroll_holding; /* live frames held until a flush */
+    GstBufferList *preroll_pending; /* flushed frames, one per create */
+    guint preroll_sent;        /* frames of preroll_pending already given */
+    gboolean preroll_resume;   /* next live frame restores the segment */
+    GstSegment preroll_stream; /* live segment, saved during a flush */
+    gulong preroll_probe;      /* src pad probe pushing the segments */
+    GstClockTime pushed_end;   /* end of the last live buffer pushed */
+
+    /* Ring capture mode */
+    gboolean use_ring;
+    GstMMALSrcRing ring;
+    gint ring_fd;              /* eventfd signalled on each ring put */
+    /* MMAL callback thread settings, restored when the port stops */
+    gboolean capture_ready;
+    gboolean capture_saved;
+    pthread_t capture_thread;
+    cpu_set_t capture_cpus;
+    int capture_policy;
+    struct sched_param capture_param;
+    gboolean streaming_thread_ready;
+    /* Streaming thread settings, restored when it leaves the task */
+    gboolean streaming_saved;
+    cpu_set_t streaming_cpus;
+    int streaming_policy;
+    struct sched_param streaming_param;
+
+    /* Latency tracing */
+    gboolean tracing;
+    gint64 stc_offset;         /* monotonic time minus VideoCore STC */
+    gboolean stc_valid;
+    gulong latency_probe;
+    GstMMALSrcLatencyStage latency_stages[MMALSRC_LATENCY_STAGES];
+    guint latency_frames;      /* frames since the last report */
+
+    /* Change detection state */
+    guint8 *motion_ref;        /* luma grid of the last pushed frame */
+    guint8 *motion_cur;        /* luma grid of the current frame */
+    gboolean motion_ref_valid;
+    gboolean motion_active;    /* scene currently considered moving */
+    guint motion_static_count; /* consecutive static frames */
+    guint motion_gated_count;  /* static frames since the last push */
+    guint motion_score;        /* score of the last analysed frame */
+    guint luma_stride;         /* bytes per luma line */
+    guint luma_step;           /* bytes between two luma samples */
+    guint luma_offset;         /* offset of the first luma sample */
+
+    /* Decimation state */
+    guint64 decimate_acc;      /* output rate accumulated over sensor frames */
+    volatile gint burst_remaining; /* frames left to push at full rate */
+    gboolean burst_frame;      /* the selected frame belongs to a burst */
+
     // VideoCore events
     VCOS_EVENT_FLAGS_T events;
 
@@ -103,6 +437,10 @@ struct _GstMMALSrc
 struct _GstMMALSrcClass
 {
     GstPushSrcClass parent_class;
+
+    /* Actions */
+    void (*burst) (GstMMALSrc *mmalsrc, guint frames);
+    void (*flush_preroll) (GstMMALSrc *mmalsrc);
 };
 
 GType gst_mmalsrc_get_type (void);
@@ -0,0 +1,193 @@
+/* Smile MMALSRC GStreamer element
+ * Copyright (C) 2017 Alexandra Hospital <hospital.alex@gmail.com>
+ * Copyright (C) 2017 Fabien Dutuit <fabien.dutuit@smile.fr>
+ *
+ * Unpacking of MIPI CSI-2 packed raw Bayer lines (RAW10, RAW12).
+ */
+
+#include "gstmmalunpack.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MMAL_UNPACK_NEON 1
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define MMAL_UNPACK_SSSE3 1
+#endif
+
+/******************************************************************
+ * Plain C
+ ******************************************************************/
+
+/******************************************************************
+ * unpack_pixel
+ * Value of pixel x of a packed line, on bits.
+ ******************************************************************/
+static inline unsigned int unpack_pixel(const uint8_t *src, unsigned int x,
+		unsigned int bits) {
+	const uint8_t *g;
+
+	if (bits == 10) {
+		g = src + (x / 4) * 5;
+		return (g[x % 4] << 2) | ((g[4] >> (2 * (x % 4))) & 0x3);
+	}
+
+	g = src + (x / 2) * 3;
+	return (g[x % 2] << 4) | ((g[2] >> (4 * (x % 2))) & 0xF);
+}
+
+/******************************************************************
+ * unpack_line_c
+ * Unpack pixels [x, width) of a line.
+ ******************************************************************/
+static void unpack_line_c(const uint8_t *src, void *dst, unsigned int x,
+		unsigned int width, unsigned int bits, unsigned int out_bits,
+		unsigned int shift) {
+	if (out_bits == 16) {
+		uint16_t *d = (uint16_t *) dst;
+
+		for (; x < width; x++)
+			d[x] = unpack_pixel(src, x, bits) << (16 - bits);
+	} else {
+		uint8_t *d = (uint8_t *) dst;
+
+		for (; x < width; x++) {
+			unsigned int v = unpack_pixel(src, x, bits) >> shift;
+			d[x] = v > 255 ? 255 : v;
+		}
+	}
+}
+
+void gst_mmal_unpack_line_c(const uint8_t *src, void *dst, unsigned int width,
+		unsigned int bits, unsigned int out_bits, unsigned int shift) {
+	unpack_line_c(src, dst, 0, width, bits, out_bits, shift);
+}
+
+/******************************************************************
+ * SIMD
+ *
+ * Each step turns 8 pixels (10 or 12 packed bytes) into 8 16-bit lanes.
+ * A byte shuffle puts the MSB byte and the shared LSB byte of each
+ * pixel in its lane, then a per-lane shift extracts the LSBs.
+ * 16 bytes are loaded per step, the loop runs while a full load still
+ * fits in the packed line.
+ ******************************************************************/
+
+#if defined(MMAL_UNPACK_NEON)
+
+static const uint8_t raw10_msb_idx[16] = { 0, 255, 1, 255, 2, 255, 3, 255,
+		5, 255, 6, 255, 7, 255, 8, 255 };
+static const uint8_t raw10_lsb_idx[16] = { 4, 255, 4, 255, 4, 255, 4, 255,
+		9, 255, 9, 255, 9, 255, 9, 255 };
+static const int16_t raw10_lsb_shift[8] = { 0, -2, -4, -6, 0, -2, -4, -6 };
+
+static const uint8_t raw12_msb_idx[16] = { 0, 255, 1, 255, 3, 255, 4, 255,
+		6, 255, 7, 255, 9, 255, 10, 255 };
+static const uint8_t raw12_lsb_idx[16] = { 2, 255, 2, 255, 5, 255, 5, 255,
+		8, 255, 8, 255, 11, 255, 11, 255 };
+static const int16_t raw12_lsb_shift[8] = { 0, -4, 0, -4, 0, -4, 0, -4 };
+
+static inline uint16x8_t unpack_lookup(uint8x8x2_t table, const uint8_t *idx) {
+	return vreinterpretq_u16_u8(vcombine_u8(vtbl2_u8(table, vld1_u8(idx)),
+			vtbl2_u8(table, vld1_u8(idx + 8))));
+}
+
+static unsigned int unpack_line_simd(const uint8_t *src, void *dst,
+		unsigned int width, unsigned int bits, unsigned int out_bits,
+		unsigned int shift) {
+	unsigned int size = MMAL_UNPACK_PACKED_SIZE(width, bits);
+	const uint8_t *msb_idx = bits == 10 ? raw10_msb_idx : raw12_msb_idx;
+	const uint8_t *lsb_idx = bits == 10 ? raw10_lsb_idx : raw12_lsb_idx;
+	int16x8_t lsb_shift = vld1q_s16(bits == 10 ? raw10_lsb_shift : raw12_lsb_shift);
+	uint16x8_t lsb_mask = vdupq_n_u16(bits == 10 ? 0x3 : 0xF);
+	int16x8_t msb_shift = vdupq_n_s16(bits - 8);
+	int16x8_t out_shift = vdupq_n_s16(out_bits == 16 ? 16 - bits : -(int) shift);
+	unsigned int x, offset;
+
+	for (x = 0, offset = 0; x + 8 <= width && offset + 16 <= size;
+			x += 8, offset += bits) {
+		uint8x16_t in = vld1q_u8(src + offset);
+		uint8x8x2_t table = { { vget_low_u8(in), vget_high_u8(in) } };
+		uint16x8_t msb = unpack_lookup(table, msb_idx);
+		uint16x8_t lsb = unpack_lookup(table, lsb_idx);
+		uint16x8_t v = vorrq_u16(vshlq_u16(msb, msb_shift),
+				vandq_u16(vshlq_u16(lsb, lsb_shift), lsb_mask));
+
+		if (out_bits == 16)
+			vst1q_u16((uint16_t *) dst + x, vshlq_u16(v, out_shift));
+		else
+			vst1_u8((uint8_t *) dst + x, vqmovn_u16(vshlq_u16(v, out_shift)));
+	}
+	return x;
+}
+
+#elif defined(MMAL_UNPACK_SSSE3)
+
+static unsigned int unpack_line_simd(const uint8_t *src, void *dst,
+		unsigned int width, unsigned int bits, unsigned int out_bits,
+		unsigned int shift) {
+	unsigned int size = MMAL_UNPACK_PACKED_SIZE(width, bits);
+	__m128i msb_idx, lsb_idx, lsb_mul, lsb_mask;
+	__m128i msb_shift = _mm_cvtsi32_si128(bits - 8);
+	__m128i lsb_shift = _mm_cvtsi32_si128(16 - bits);
+	__m128i out_shift = _mm_cvtsi32_si128(out_bits == 16 ? 16 - bits : shift);
+	unsigned int x, offset;
+
+	if (bits == 10) {
+		msb_idx = _mm_setr_epi8(0, -1, 1, -1, 2, -1, 3, -1,
+				5, -1, 6, -1, 7, -1, 8, -1);
+		lsb_idx = _mm_setr_epi8(4, -1, 4, -1, 4, -1, 4, -1,
+				9, -1, 9, -1, 9, -1, 9, -1);
+		/* Move the 2 LSBs of lane k to bits 7:6 */
+		lsb_mul = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+		lsb_mask = _mm_set1_epi16(0x3);
+	} else {
+		msb_idx = _mm_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1,
+				6, -1, 7, -1, 9, -1, 10, -1);
+		lsb_idx = _mm_setr_epi8(2, -1, 2, -1, 5, -1, 5, -1,
+				8, -1, 8, -1, 11, -1, 11, -1);
+		/* Move the 4 LSBs of lane k to bits 7:4 */
+		lsb_mul = _mm_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1);
+		lsb_mask = _mm_set1_epi16(0xF);
+	}
+
+	for (x = 0, offset = 0; x + 8 <= width && offset + 16 <= size;
+			x += 8, offset += bits) {
+		__m128i in = _mm_loadu_si128((const __m128i *) (src + offset));
+		__m128i msb = _mm_shuffle_epi8(in, msb_idx);
+		__m128i lsb = _mm_mullo_epi16(_mm_shuffle_epi8(in, lsb_idx), lsb_mul);
+		__m128i v = _mm_or_si128(_mm_sll_epi16(msb, msb_shift),
+				_mm_and_si128(_mm_srl_epi16(lsb, lsb_shift), lsb_mask));
+
+		if (out_bits == 16) {
+			_mm_storeu_si128((__m128i *) ((uint16_t *) dst + x),
+					_mm_sll_epi16(v, out_shift));
+		} else {
+			v = _mm_srl_epi16(v, out_shift);
+			_mm_storel_epi64((__m128i *) ((uint8_t *) dst + x),
+					_mm_packus_epi16(v, v));
+		}
+	}
+	return x;
+}
+
+#else
+
+static unsigned int unpack_line_simd(const uint8_t *src, void *dst,
+		unsigned int width, unsigned int bits, unsigned int out_bits,
+		unsigned int shift) {
+	return 0;
+}
+
+#endif
+
+/******************************************************************
+ * gst_mmal_unpack_line
+ ******************************************************************/
+void gst_mmal_unpack_line(const uint8_t *src, void *dst, unsigned int width,
+		unsigned int bits, unsigned int out_bits, unsigned int shift) {
+	unsigned int x = unpack_line_simd(src, dst, width, bits, out_bits, shift);
+
+	/* Remaining pixels start on a packing group boundary */
+	unpack_line_c(src, dst, x, width, bits, out_bits, shift);
+}
@@ -0,0 +1,44 @@
+/* Smile MMALSRC GStreamer element
+ * Copyright (C) 2017 Alexandra Hospital <hospital.alex@gmail.com>
+ * Copyright (C) 2017 Fabien Dutuit <fabien.dutuit@smile.fr>
+ *
+ * Unpacking of MIPI CSI-2 packed raw Bayer lines (RAW10, RAW12).
+ * Only depends on the C library, so it can be checked on any host
+ * against reference data.
+ */
+
+#ifndef _GST_MMALUNPACK_H_
+#define _GST_MMALUNPACK_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Packed line size in bytes of width pixels of bits (10 or 12) */
+#define MMAL_UNPACK_PACKED_SIZE(width, bits) (((width) * (bits) + 7) / 8)
+
+/*
+ * Unpack one line of width pixels packed on bits (10 or 12).
+ *
+ * out_bits 16 : dst holds uint16_t samples, MSB aligned (value << (16 - bits))
+ * out_bits 8  : dst holds uint8_t samples, value >> shift, saturated to 255
+ *
+ * RAW10 : 4 pixels in 5 bytes, bits 9:2 of each pixel then one byte of
+ *         bits 1:0 (pixel 0 in the low bits).
+ * RAW12 : 2 pixels in 3 bytes, bits 11:4 of each pixel then one byte of
+ *         bits 3:0 (pixel 0 in the low nibble).
+ */
+void gst_mmal_unpack_line(const uint8_t *src, void *dst, unsigned int width,
+		unsigned int bits, unsigned int out_bits, unsigned int shift);
+
+/* Plain C version of gst_mmal_unpack_line, reference for the SIMD paths */
+void gst_mmal_unpack_line_c(const uint8_t *src, void *dst, unsigned int width,
+		unsigned int bits, unsigned int out_bits, unsigned int shift);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _GST_MMALUNPACK_H_ */
@@ -0,0 +1,169 @@
+/* Smile MMALSRC GStreamer element
+ * Copyright (C) 2017 Alexandra Hospital <hospital.alex@gmail.com>
+ * Copyright (C) 2017 Fabien Dutuit <fabien.dutuit@smile.fr>
+ *
+ * Host check of the luma pyramid: SIMD box filter against the C one on
+ * random lines, strip-wise build against a level by level reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gstmmalpyramid.h"
+
+#define MAX_WIDTH 100
+/* Bytes after each level line that the build must leave alone */
+#define PAD 3
+#define CANARY 0xA5
+
+static int failures;
+
+/******************************************************************
+ * check_bytes
+ * Compare n bytes and report the first difference.
+ ******************************************************************/
+static void check_bytes(const char *what, const uint8_t *got,
+		const uint8_t *expected, size_t n) {
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (got[i] != expected[i]) {
+			printf("FAIL %s : byte %zu is 0x%02x, expected 0x%02x\n", what, i,
+					got[i], expected[i]);
+			failures++;
+			return;
+		}
+	}
+}
+
+/******************************************************************
+ * random_fill
+ ******************************************************************/
+static uint8_t *random_fill(size_t size) {
+	uint8_t *p = malloc(size);
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		p[i] = rand();
+	return p;
+}
+
+/******************************************************************
+ * test_line
+ * gst_mmal_pyramid_line against gst_mmal_pyramid_line_c for every
+ * width and sample step, on lines exactly sized to catch overreads.
+ ******************************************************************/
+static void test_line(void) {
+	static const unsigned int steps[3] = { 1, 2, 4 };
+	uint8_t ref[MAX_WIDTH], out[MAX_WIDTH];
+	unsigned int width, s, filter;
+	char what[64];
+
+	srand(1);
+	for (s = 0; s < 3; s++) {
+		for (width = 1; width <= MAX_WIDTH; width++) {
+			/* The last sample of a line is its first byte for step > 1 */
+			size_t size = (2 * width - 1) * steps[s] + 1;
+			uint8_t *src0 = random_fill(size);
+			uint8_t *src1 = random_fill(size);
+
+			for (filter = MMAL_PYRAMID_FILTER_BOX;
+					filter <= MMAL_PYRAMID_FILTER_NEAREST; filter++) {
+				snprintf(what, sizeof(what), "line step %u width %u filter %u",
+						steps[s], width, filter);
+				gst_mmal_pyramid_line_c(src0, src1, ref, width, steps[s],
+						filter);
+				gst_mmal_pyramid_line(src0, src1, out, width, steps[s], filter);
+				check_bytes(what, out, ref, width);
+			}
+			free(src0);
+			free(src1);
+		}
+	}
+}
+
+/******************************************************************
+ * test_build_one
+ * gst_mmal_pyramid_build against levels built one after the other
+ * over the whole frame. Level lines are padded with a canary that
+ * must survive.
+ ******************************************************************/
+static void test_build_one(unsigned int width, unsigned int height,
+		unsigned int step, unsigned int levels, unsigned int filter) {
+	unsigned int stride = width * step;
+	uint8_t *src = random_fill((size_t) stride * height);
+	uint8_t *dst[MMAL_PYRAMID_MAX_LEVELS], *ref[MMAL_PYRAMID_MAX_LEVELS];
+	unsigned int dst_stride[MMAL_PYRAMID_MAX_LEVELS];
+	unsigned int l, r, w, h;
+	char what[80];
+
+	for (l = 1; l <= levels; l++) {
+		w = width >> l;
+		h = height >> l;
+		dst_stride[l - 1] = w + PAD;
+		dst[l - 1] = malloc((size_t) dst_stride[l - 1] * h + 1);
+		ref[l - 1] = malloc((size_t) dst_stride[l - 1] * h + 1);
+		memset(dst[l - 1], CANARY, (size_t) dst_stride[l - 1] * h + 1);
+		memset(ref[l - 1], CANARY, (size_t) dst_stride[l - 1] * h + 1);
+	}
+
+	for (l = 1; l <= levels; l++) {
+		const uint8_t *in = l == 1 ? src : ref[l - 2];
+		unsigned int in_stride = l == 1 ? stride : dst_stride[l - 2];
+		unsigned int in_step = l == 1 ? step : 1;
+
+		for (r = 0; r < height >> l; r++)
+			gst_mmal_pyramid_line_c(in + 2 * r * in_stride,
+					in + (2 * r + 1) * in_stride, ref[l - 1] + r * dst_stride[l - 1],
+					width >> l, in_step, filter);
+	}
+
+	gst_mmal_pyramid_build(src, stride, step, width, height, dst, dst_stride,
+			levels, filter);
+
+	for (l = 1; l <= levels; l++) {
+		snprintf(what, sizeof(what),
+				"build %ux%u step %u levels %u filter %u, level %u", width,
+				height, step, levels, filter, l);
+		check_bytes(what, dst[l - 1], ref[l - 1],
+				(size_t) dst_stride[l - 1] * (height >> l) + 1);
+		free(dst[l - 1]);
+		free(ref[l - 1]);
+	}
+	free(src);
+}
+
+/******************************************************************
+ * test_build
+ * Heights around the strip size of every level count, so that the
+ * last strip is full, short or a single line.
+ ******************************************************************/
+static void test_build(void) {
+	static const unsigned int widths[3] = { 16, 37, 100 };
+	static const unsigned int steps[3] = { 1, 2, 4 };
+	unsigned int levels, strip, height, w, s, filter;
+
+	srand(2);
+	for (levels = 1; levels <= MMAL_PYRAMID_MAX_LEVELS; levels++) {
+		strip = 1u << levels;
+		for (height = 1; height <= 3 * strip + 1; height++)
+			for (w = 0; w < 3; w++)
+				for (s = 0; s < 3; s++)
+					for (filter = MMAL_PYRAMID_FILTER_BOX;
+							filter <= MMAL_PYRAMID_FILTER_NEAREST; filter++)
+						test_build_one(widths[w], height, steps[s], levels,
+								filter);
+	}
+}
+
+int main(void) {
+	test_line();
+	test_build();
+
+	if (failures)
+		printf("%d pyramid checks failed\n", failures);
+	else
+		printf("pyramid checks passed\n");
+	return failures ? 1 : 0;
+}
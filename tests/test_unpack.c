@@ -0,0 +1,120 @@
+/* Smile MMALSRC GStreamer element
+ * Copyright (C) 2017 Alexandra Hospital <hospital.alex@gmail.com>
+ * Copyright (C) 2017 Fabien Dutuit <fabien.dutuit@smile.fr>
+ *
+ * Host check of the raw Bayer unpacking: reference vectors for the C
+ * version, SIMD version against the C one on random lines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gstmmalunpack.h"
+
+#define MAX_WIDTH 200
+
+static int failures;
+
+/******************************************************************
+ * check_bytes
+ * Compare n bytes and report the first difference.
+ ******************************************************************/
+static void check_bytes(const char *what, const void *got, const void *expected,
+		size_t n) {
+	const uint8_t *g = (const uint8_t *) got;
+	const uint8_t *e = (const uint8_t *) expected;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (g[i] != e[i]) {
+			printf("FAIL %s : byte %zu is 0x%02x, expected 0x%02x\n", what, i,
+					g[i], e[i]);
+			failures++;
+			return;
+		}
+	}
+}
+
+/******************************************************************
+ * test_vectors
+ * RAW10 and RAW12 groups with known pixel values.
+ ******************************************************************/
+static void test_vectors(void) {
+	/* Pixels 0x3FF 0x001 0x2AA 0x155 */
+	static const uint8_t raw10[5] = { 0xFF, 0x00, 0xAA, 0x55, 0x67 };
+	static const uint16_t raw10_16[4] = { 0xFFC0, 0x0040, 0xAA80, 0x5540 };
+	static const uint8_t raw10_8[4] = { 0xFF, 0x00, 0xAA, 0x55 };
+	static const uint8_t raw10_8_sat[4] = { 0xFF, 0x01, 0xFF, 0xFF };
+	/* Pixels 0xFFF 0x123 */
+	static const uint8_t raw12[3] = { 0xFF, 0x12, 0x3F };
+	static const uint16_t raw12_16[2] = { 0xFFF0, 0x1230 };
+	static const uint8_t raw12_8[2] = { 0xFF, 0x12 };
+	uint16_t out16[4];
+	uint8_t out8[4];
+
+	gst_mmal_unpack_line_c(raw10, out16, 4, 10, 16, 0);
+	check_bytes("raw10 16-bit", out16, raw10_16, sizeof(raw10_16));
+	gst_mmal_unpack_line_c(raw10, out8, 4, 10, 8, 2);
+	check_bytes("raw10 8-bit", out8, raw10_8, sizeof(raw10_8));
+	gst_mmal_unpack_line_c(raw10, out8, 4, 10, 8, 0);
+	check_bytes("raw10 8-bit saturated", out8, raw10_8_sat,
+			sizeof(raw10_8_sat));
+
+	gst_mmal_unpack_line_c(raw12, out16, 2, 12, 16, 0);
+	check_bytes("raw12 16-bit", out16, raw12_16, sizeof(raw12_16));
+	gst_mmal_unpack_line_c(raw12, out8, 2, 12, 8, 4);
+	check_bytes("raw12 8-bit", out8, raw12_8, sizeof(raw12_8));
+}
+
+/******************************************************************
+ * test_simd
+ * gst_mmal_unpack_line against gst_mmal_unpack_line_c on random
+ * lines, exactly sized to catch overreads. CSI-2 lines hold whole
+ * packing groups (4 RAW10 or 2 RAW12 pixels), widths step by a group
+ * to cover every SIMD tail.
+ ******************************************************************/
+static void test_simd(void) {
+	static const unsigned int bits[2] = { 10, 12 };
+	static const unsigned int group[2] = { 4, 2 };
+	uint16_t ref[MAX_WIDTH], out[MAX_WIDTH];
+	unsigned int width, b, shift, i;
+	char what[64];
+
+	srand(1);
+	for (b = 0; b < 2; b++) {
+		for (width = group[b]; width <= MAX_WIDTH; width += group[b]) {
+			unsigned int size = MMAL_UNPACK_PACKED_SIZE(width, bits[b]);
+			uint8_t *src = malloc(size);
+
+			for (i = 0; i < size; i++)
+				src[i] = rand();
+
+			snprintf(what, sizeof(what), "raw%u 16-bit width %u", bits[b],
+					width);
+			gst_mmal_unpack_line_c(src, ref, width, bits[b], 16, 0);
+			gst_mmal_unpack_line(src, out, width, bits[b], 16, 0);
+			check_bytes(what, out, ref, width * 2);
+
+			for (shift = 0; shift <= bits[b] - 8; shift++) {
+				snprintf(what, sizeof(what), "raw%u 8-bit width %u shift %u",
+						bits[b], width, shift);
+				gst_mmal_unpack_line_c(src, ref, width, bits[b], 8, shift);
+				gst_mmal_unpack_line(src, out, width, bits[b], 8, shift);
+				check_bytes(what, out, ref, width);
+			}
+			free(src);
+		}
+	}
+}
+
+int main(void) {
+	test_vectors();
+	test_simd();
+
+	if (failures)
+		printf("%d unpack checks failed\n", failures);
+	else
+		printf("unpack checks passed\n");
+	return failures ? 1 : 0;
+}